@@ -1,8 +1,12 @@
 #include "wsq.h"
+#include "topology.h"
+#include "pool.h"
 #include <thread>
 #include <chrono>
 #include <iostream>
 #include <numeric>
+#include <algorithm>
+#include <vector>
 #include <stdexcept>
 #include <pthread.h>
 #include <sched.h>
@@ -10,16 +14,67 @@
 //TODO:
 
 void pinThread(int cpu) {
-	if (cpu < 0) {
-		return;
+	if (const auto err = pin_current_thread(cpu)) {
+		std::cerr << "Could not pin thread to CPU " << cpu << " (" << err.message() << "), running unpinned"
+				<< std::endl;
 	}
-	cpu_set_t cpuset;
-	CPU_ZERO(&cpuset);
-	CPU_SET(cpu, &cpuset);
-	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == -1) {
-		perror("pthread_setaffinity_np");
-		exit(1);
+}
+
+void spinFor(std::chrono::nanoseconds duration) {
+	const auto until = std::chrono::steady_clock::now() + duration;
+	while (std::chrono::steady_clock::now() < until) {
+	}
+}
+
+// Spawn-to-start latencies (ns) of requests arriving in bursts at an owner that serves them
+// from its own queue while one thief steals.
+template<OwnerOrder Order>
+std::vector<int64_t> spawnToStart(int requests, int ownerCpu, int thiefCpu) {
+	using Clock = std::chrono::steady_clock;
+	const auto work = std::chrono::microseconds(2);
+	WorkStealingQueue<Clock::time_point, (1 << 16), Order> q;
+	std::atomic<bool> done{false};
+	std::vector<int64_t> ownerLatencies, thiefLatencies;
+	ownerLatencies.reserve(requests);
+	thiefLatencies.reserve(requests);
+	auto serve = [&](std::vector<int64_t> &latencies, Clock::time_point spawned) {
+		latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - spawned).count());
+		spinFor(work);
+	};
+
+	auto thief = std::thread([&] {
+		pinThread(thiefCpu);
+		while (!done.load(std::memory_order_acquire)) {
+			if (auto spawned = q.steal()) {
+				serve(thiefLatencies, *spawned);
+			}
+		}
+	});
+
+	pinThread(ownerCpu);
+	uint64_t rng = 42;
+	int spawned = 0;
+	while (spawned < requests || !q.empty()) {
+		// A burst of 8 on one iteration in 8: on average one arrival per request served.
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		if (spawned < requests && rng % 8 == 0) {
+			for (int b = 0; b < 8; ++b) {
+				q.emplace(Clock::now());
+			}
+			spawned += 8;
+		}
+		if (auto start = q.pop()) {
+			serve(ownerLatencies, *start);
+		}
 	}
+	done.store(true, std::memory_order_release);
+	thief.join();
+
+	ownerLatencies.insert(ownerLatencies.end(), thiefLatencies.begin(), thiefLatencies.end());
+	std::sort(ownerLatencies.begin(), ownerLatencies.end());
+	return ownerLatencies;
 }
 
 void printCurrentCPU(const char* tag) {
@@ -34,13 +89,28 @@ namespace {
 int main(int argc, char *argv[]) {
 	(void) argc, (void) argv;
 
-	int cpu1 = -1;
-	int cpu2 = -1;
+	const int numThieves = 2;
 
+	// Producer CPU first, then one per consumer. Explicit "consumer producer" CPUs from argv keep
+	// their old meaning (thieves on consecutive CPUs); otherwise place every thread on its own
+	// physical core, sharing a last-level cache where possible.
+	std::vector<int> placement;
 	if (argc == 3) {
-		cpu1 = std::stoi(argv[1]);
-		cpu2 = std::stoi(argv[2]);
+		const int consumer = std::stoi(argv[1]);
+		placement.push_back(std::stoi(argv[2]));
+		for (int tId = 0; tId < numThieves; ++tId)
+			placement.push_back(consumer + tId);
+	} else {
+		const auto topology = CpuTopology::discover();
+		placement = topology.plan(1 + numThieves, Placement::CoresFirst);
+		std::cout << "Placement over " << topology.num_cpus() << " CPUs (" << topology.num_cores() << " cores, "
+				<< topology.num_llcs() << " LLC domains, " << topology.num_numa_nodes() << " NUMA nodes):";
+		for (const int cpu: placement)
+			std::cout << " " << cpu;
+		std::cout << std::endl;
 	}
+	const int producerCpu = placement[0];
+	const int consumerCpu = placement[1];
 
 	const int64_t iters = 10'000'000;
 
@@ -54,7 +124,7 @@ int main(int argc, char *argv[]) {
 		{
 			example_queue q;
 			auto t = std::thread([&] {
-				pinThread(cpu1);
+				pinThread(consumerCpu);
 				// printCurrentCPU("Consumer thread");
 				for (int i = 0; i < iters; ++i) {
 					std::optional<int> val;
@@ -68,7 +138,7 @@ int main(int argc, char *argv[]) {
 				}
 			});
 
-			pinThread(cpu2);
+			pinThread(producerCpu);
 			// printCurrentCPU("Producer thread");
 			auto start = std::chrono::steady_clock::now();
 			for (int i = 0; i < iters; ++i) {
@@ -86,7 +156,6 @@ int main(int argc, char *argv[]) {
 		// 2. Single producer, multiple consumers
 		// ---------------------------------------------------
 		{
-			const int numThieves = 2;
 			std::vector<std::thread> thieves;
 			std::vector<example_queue> thieves_queues(numThieves);
 			example_queue producer;
@@ -96,7 +165,7 @@ int main(int argc, char *argv[]) {
 			// start thieves
 			for (int tId = 0; tId < numThieves; ++tId) {
 				thieves.emplace_back([&, tId] {
-					pinThread((cpu1 >= 0) ? cpu1 + tId : -1);
+					pinThread(placement[1 + tId]);
 					// printCurrentCPU("Consumer thread");
 
 					auto &localQ = thieves_queues[tId];
@@ -109,7 +178,7 @@ int main(int argc, char *argv[]) {
 					}
 				});
 			}
-			pinThread(cpu2);
+			pinThread(producerCpu);
 			// printCurrentCPU("Producer thread");
 
 			auto start = std::chrono::steady_clock::now();
@@ -133,7 +202,7 @@ int main(int argc, char *argv[]) {
 			example_queue q1, q2;
 
 			auto t = std::thread([&] {
-				pinThread(cpu1);
+				pinThread(consumerCpu);
 				// printCurrentCPU("Consumer thread");
 				for (int i = 0; i < iters; ++i) {
 					std::optional<int> val;
@@ -143,7 +212,7 @@ int main(int argc, char *argv[]) {
 				}
 			});
 
-			pinThread(cpu2);
+			pinThread(producerCpu);
 			// printCurrentCPU("Producer thread");
 
 			std::vector<std::chrono::nanoseconds> latencies;
@@ -181,6 +250,104 @@ int main(int argc, char *argv[]) {
 			std::cout << "    p99.9: " << p99_9 << std::endl;
 			std::cout << "    p99.99: " << p99_99 << std::endl;
 		}
+
+		// ---------------------------------------------------
+		// 4. Per-operation cost (uncontended), input for WSQSim
+		// ---------------------------------------------------
+		{
+			example_queue q;
+			const int64_t ops = std::min<int64_t>(iters, q.capacity());
+			auto perOp = [&](auto &&op) {
+				auto start = std::chrono::steady_clock::now();
+				for (int64_t i = 0; i < ops; ++i) {
+					op(i);
+				}
+				auto stop = std::chrono::steady_clock::now();
+				return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() / ops;
+			};
+			auto emplaceNs = perOp([&](int64_t i) { q.emplace(static_cast<int>(i)); });
+			auto popNs = perOp([&](int64_t) { (void) q.pop(); });
+			for (int64_t i = 0; i < ops; ++i) {
+				q.emplace(static_cast<int>(i));
+			}
+			auto stealNs = perOp([&](int64_t) { (void) q.steal(); });
+
+			std::cout << "Per-operation cost (ns, emplace pop steal): "
+					<< emplaceNs << " " << popNs << " " << stealNs << std::endl;
+		}
+
+		// ---------------------------------------------------
+		// 5. Deadline tasks under mixed load: plain submit vs. EDF lane
+		// ---------------------------------------------------
+		{
+			const int bulkTasks = 12800;
+			const auto bulkWork = std::chrono::microseconds(10);
+			const int arrivals = 64;
+			const auto interval = std::chrono::milliseconds(1);
+			const auto budget = std::chrono::milliseconds(2);
+			WorkStealingPool pool(placement);
+
+			// A backlog of bulk work spawned on a worker's deque, plus latency-sensitive requests
+			// arriving from outside the pool at a fixed interval, each due budget after arrival.
+			auto run = [&](bool edf) {
+				std::atomic<int> left{bulkTasks + arrivals};
+				std::atomic<int> missed{0};
+				pool.submit([&] {
+					for (int b = 0; b < bulkTasks; ++b) {
+						pool.submit([&] {
+							spinFor(bulkWork);
+							left.fetch_sub(1, std::memory_order_acq_rel);
+						});
+					}
+				});
+				for (int a = 0; a < arrivals; ++a) {
+					std::this_thread::sleep_for(interval);
+					const auto deadline = std::chrono::steady_clock::now() + budget;
+					auto request = [&, deadline] {
+						spinFor(bulkWork);
+						if (std::chrono::steady_clock::now() > deadline) {
+							missed.fetch_add(1, std::memory_order_relaxed);
+						}
+						left.fetch_sub(1, std::memory_order_acq_rel);
+					};
+					if (edf) {
+						pool.submit(request, deadline);
+					} else {
+						pool.submit(request);
+					}
+				}
+				while (left.load(std::memory_order_acquire) != 0) {
+					std::this_thread::yield();
+				}
+				return missed.load();
+			};
+			const auto plainMissed = run(false);
+			const auto edfMissed = run(true);
+
+			std::cout << "Missed deadlines (" << arrivals << " requests every " << interval.count() << "ms, "
+					<< budget.count() << "ms budget, " << bulkTasks << " bulk tasks, " << pool.num_workers()
+					<< " workers):\n";
+			std::cout << "    plain submit: " << plainMissed << "\n";
+			std::cout << "    EDF lane:     " << edfMissed << std::endl;
+		}
+
+		// ---------------------------------------------------
+		// 6. Spawn-to-start latency: LIFO vs. FIFO owner order
+		// ---------------------------------------------------
+		{
+			const int requests = 200'000;
+			auto report = [](const char *name, const std::vector<int64_t> &latencies) {
+				std::cout << "    " << name << " p50: " << latencies[latencies.size() / 2]
+						<< "ns, p99: " << latencies[latencies.size() * 99 / 100]
+						<< "ns, max: " << latencies.back() << "ns\n";
+			};
+			const auto lifo = spawnToStart<OwnerOrder::Lifo>(requests, producerCpu, consumerCpu);
+			const auto fifo = spawnToStart<OwnerOrder::Fifo>(requests, producerCpu, consumerCpu);
+			std::cout << "Spawn-to-start latency (" << requests << " bursty requests, owner + 1 thief):\n";
+			report("LIFO", lifo);
+			report("FIFO", fifo);
+			std::cout.flush();
+		}
 	}
 	return 0;
 }
@@ -0,0 +1,325 @@
+#include "wsq.h"
+#include "topology.h"
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: WSQGraphBench [scale] [max_threads]
+// R-MAT power-law graph with 2^scale vertices and 16 * 2^scale edges; BFS and label-propagation
+// connected components with frontier vertices in per-thread WorkStealingQueues.
+
+namespace {
+	using Vertex = uint32_t;
+	constexpr Vertex kUnvisited = ~Vertex{0};
+	constexpr size_t kDequeCapacity = 1 << 20;
+	using VertexQueue = WorkStealingQueue<Vertex, kDequeCapacity>;
+
+	struct Graph {
+		size_t n = 0;
+		std::vector<uint64_t> offsets;
+		std::vector<Vertex> targets;
+
+		[[nodiscard]] size_t degree(Vertex v) const { return offsets[v + 1] - offsets[v]; }
+	};
+
+	// Undirected R-MAT (a, b, c) = (0.57, 0.19, 0.19) in CSR form, self-loops dropped.
+	Graph rmat(int scale, int edgeFactor, uint64_t seed) {
+		const size_t n = size_t{1} << scale;
+		const size_t m = n * edgeFactor;
+		std::mt19937_64 rng(seed);
+		std::uniform_real_distribution<double> coin(0.0, 1.0);
+		std::vector<std::pair<Vertex, Vertex> > edges;
+		edges.reserve(2 * m);
+		for (size_t e = 0; e < m; ++e) {
+			Vertex u = 0, v = 0;
+			for (int bit = 0; bit < scale; ++bit) {
+				const double r = coin(rng);
+				const Vertex down = r >= 0.57 + 0.19;
+				const Vertex right = (r >= 0.57 && r < 0.57 + 0.19) || r >= 0.57 + 0.19 + 0.19;
+				u = (u << 1) | down;
+				v = (v << 1) | right;
+			}
+			if (u != v) {
+				edges.emplace_back(u, v);
+				edges.emplace_back(v, u);
+			}
+		}
+		// Scramble ids so high-degree vertices aren't clustered at low ids.
+		std::vector<Vertex> perm(n);
+		std::iota(perm.begin(), perm.end(), Vertex{0});
+		std::shuffle(perm.begin(), perm.end(), rng);
+
+		Graph g;
+		g.n = n;
+		g.offsets.assign(n + 1, 0);
+		for (const auto &[u, v]: edges) {
+			++g.offsets[perm[u] + 1];
+		}
+		std::partial_sum(g.offsets.begin(), g.offsets.end(), g.offsets.begin());
+		g.targets.resize(edges.size());
+		auto fill = g.offsets;
+		for (const auto &[u, v]: edges) {
+			g.targets[fill[perm[u]]++] = perm[v];
+		}
+		return g;
+	}
+
+	// Per-thread deque plus an owner-only overflow for the rare push that finds it full.
+	struct alignas(kCacheLineSize) Frontier {
+		std::unique_ptr<VertexQueue> deque = std::make_unique<VertexQueue>();
+		std::vector<Vertex> overflow;
+
+		void push(Vertex v) {
+			if (!deque->try_emplace(v)) {
+				overflow.push_back(v);
+			}
+		}
+
+		// Owner: local work first.
+		std::optional<Vertex> pop() {
+			if (auto v = deque->pop()) {
+				return v;
+			}
+			if (!overflow.empty()) {
+				const auto v = overflow.back();
+				overflow.pop_back();
+				return v;
+			}
+			return std::nullopt;
+		}
+	};
+
+	// Pop locally, else steal from the other frontiers starting at a rotating victim.
+	std::optional<Vertex> nextVertex(std::vector<Frontier> &frontiers, size_t self, size_t &victim) {
+		if (auto v = frontiers[self].pop()) {
+			return v;
+		}
+		for (size_t k = 0; k < frontiers.size(); ++k) {
+			victim = (victim + 1) % frontiers.size();
+			if (victim == self) {
+				continue;
+			}
+			if (auto v = frontiers[victim].deque->steal()) {
+				return v;
+			}
+		}
+		return std::nullopt;
+	}
+
+	void pin(const std::vector<int> &placement, size_t t) {
+		(void) pin_current_thread(placement[t % placement.size()]);
+	}
+
+	// Level-synchronous BFS: the current level lives in one set of per-thread deques, newly
+	// discovered vertices go to the other set; a barrier separates levels. Returns edges scanned.
+	uint64_t bfs(const Graph &g, Vertex root, size_t threads, const std::vector<int> &placement,
+	             std::vector<std::atomic<Vertex> > &dist) {
+		for (auto &d: dist) {
+			d.store(kUnvisited, std::memory_order_relaxed);
+		}
+		std::vector<Frontier> levels[2] = {std::vector<Frontier>(threads), std::vector<Frontier>(threads)};
+		dist[root].store(0, std::memory_order_relaxed);
+		levels[0][0].push(root);
+
+		std::atomic<uint64_t> scanned{0};
+		std::atomic<size_t> discovered{1};
+		bool done = false;
+		Vertex level = 0;
+		std::barrier sync(static_cast<std::ptrdiff_t>(threads), [&]() noexcept {
+			done = discovered.exchange(0, std::memory_order_relaxed) == 0;
+			++level;
+		});
+
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t] {
+				pin(placement, t);
+				size_t victim = t;
+				uint64_t edges = 0;
+				for (int cur = 0; !done; cur ^= 1) {
+					auto &current = levels[cur];
+					auto &next = levels[cur ^ 1][t];
+					size_t found = 0;
+					while (auto u = nextVertex(current, t, victim)) {
+						for (auto e = g.offsets[*u]; e != g.offsets[*u + 1]; ++e) {
+							const auto v = g.targets[e];
+							auto expected = kUnvisited;
+							if (dist[v].load(std::memory_order_relaxed) == kUnvisited &&
+							    dist[v].compare_exchange_strong(expected, level + 1, std::memory_order_relaxed)) {
+								next.push(v);
+								++found;
+							}
+						}
+						edges += g.degree(*u);
+					}
+					discovered.fetch_add(found, std::memory_order_relaxed);
+					sync.arrive_and_wait();
+				}
+				scanned.fetch_add(edges, std::memory_order_relaxed);
+			});
+		}
+		for (auto &w: workers) {
+			w.join();
+		}
+		return scanned.load();
+	}
+
+	// Asynchronous label propagation: every vertex starts active with its own id as label; an
+	// active vertex lowers its neighbours' labels and re-activates those it lowered onto the
+	// running thread's deque. Done when no vertex is pending anywhere. Returns edges scanned.
+	uint64_t components(const Graph &g, size_t threads, const std::vector<int> &placement,
+	                    std::vector<std::atomic<Vertex> > &label) {
+		for (Vertex v = 0; v < g.n; ++v) {
+			label[v].store(v, std::memory_order_relaxed);
+		}
+		std::vector<Frontier> frontiers(threads);
+		std::atomic<size_t> pending{g.n};
+		std::atomic<uint64_t> scanned{0};
+
+		std::vector<std::thread> workers;
+		for (size_t t = 0; t < threads; ++t) {
+			workers.emplace_back([&, t] {
+				pin(placement, t);
+				auto &own = frontiers[t];
+				// Seed in descending id order so the owner pops the smallest labels first and floods
+				// them before larger ones; seeding ascending relabels hubs over and over.
+				for (auto v = static_cast<int64_t>(g.n) - 1 - static_cast<int64_t>(t); v >= 0;
+				     v -= static_cast<int64_t>(threads)) {
+					own.push(static_cast<Vertex>(v));
+				}
+				size_t victim = t;
+				uint64_t edges = 0;
+				while (pending.load(std::memory_order_acquire) != 0) {
+					const auto u = nextVertex(frontiers, t, victim);
+					if (!u) {
+						std::this_thread::yield();
+						continue;
+					}
+					const auto mine = label[*u].load(std::memory_order_relaxed);
+					for (auto e = g.offsets[*u]; e != g.offsets[*u + 1]; ++e) {
+						const auto v = g.targets[e];
+						auto theirs = label[v].load(std::memory_order_relaxed);
+						while (mine < theirs) {
+							if (label[v].compare_exchange_weak(theirs, mine, std::memory_order_relaxed)) {
+								pending.fetch_add(1, std::memory_order_relaxed);
+								own.push(v);
+								break;
+							}
+						}
+					}
+					edges += g.degree(*u);
+					pending.fetch_sub(1, std::memory_order_acq_rel);
+				}
+				scanned.fetch_add(edges, std::memory_order_relaxed);
+			});
+		}
+		for (auto &w: workers) {
+			w.join();
+		}
+		return scanned.load();
+	}
+
+	size_t serialReachable(const Graph &g, Vertex root) {
+		std::vector<bool> seen(g.n);
+		std::vector<Vertex> stack{root};
+		seen[root] = true;
+		size_t count = 0;
+		while (!stack.empty()) {
+			const auto u = stack.back();
+			stack.pop_back();
+			++count;
+			for (auto e = g.offsets[u]; e != g.offsets[u + 1]; ++e) {
+				if (!seen[g.targets[e]]) {
+					seen[g.targets[e]] = true;
+					stack.push_back(g.targets[e]);
+				}
+			}
+		}
+		return count;
+	}
+
+	size_t serialComponents(const Graph &g) {
+		std::vector<Vertex> parent(g.n);
+		std::iota(parent.begin(), parent.end(), Vertex{0});
+		auto find = [&](Vertex v) {
+			while (parent[v] != v) {
+				v = parent[v] = parent[parent[v]];
+			}
+			return v;
+		};
+		for (Vertex u = 0; u < g.n; ++u) {
+			for (auto e = g.offsets[u]; e != g.offsets[u + 1]; ++e) {
+				parent[find(u)] = find(g.targets[e]);
+			}
+		}
+		size_t count = 0;
+		for (Vertex v = 0; v < g.n; ++v) {
+			count += find(v) == v;
+		}
+		return count;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const int scale = argc >= 2 ? std::stoi(argv[1]) : 18;
+	const auto topology = CpuTopology::discover();
+	const size_t maxThreads = argc >= 3 ? std::stoul(argv[2]) : std::max<size_t>(1, topology.num_cpus());
+	const auto placement = topology.plan(maxThreads, Placement::Scatter);
+
+	const auto start = std::chrono::steady_clock::now();
+	const auto g = rmat(scale, 16, 1);
+	const auto genMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	// Start BFS at the highest-degree vertex so it reaches the giant component.
+	Vertex root = 0;
+	for (Vertex v = 1; v < g.n; ++v) {
+		if (g.degree(v) > g.degree(root)) {
+			root = v;
+		}
+	}
+	std::cout << "R-MAT scale " << scale << ": " << g.n << " vertices, " << g.targets.size()
+			<< " directed edges, max degree " << g.degree(root) << ", generated in " << genMs.count() << "ms"
+			<< std::endl;
+	const auto reachable = serialReachable(g, root);
+	const auto componentCount = serialComponents(g);
+
+	std::vector<std::atomic<Vertex> > values(g.n);
+	auto timed = [&](auto &&run) {
+		const auto t0 = std::chrono::steady_clock::now();
+		const auto edges = run();
+		const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		return std::pair{edges, secs};
+	};
+
+	std::cout << "threads  BFS Medges/s  CC Medges/s" << std::endl;
+	for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+		const auto [bfsEdges, bfsSecs] = timed([&] { return bfs(g, root, threads, placement, values); });
+		const auto visited = static_cast<size_t>(std::count_if(values.begin(), values.end(), [](const auto &d) {
+			return d.load(std::memory_order_relaxed) != kUnvisited;
+		}));
+		const auto [ccEdges, ccSecs] = timed([&] { return components(g, threads, placement, values); });
+		size_t roots = 0;
+		for (Vertex v = 0; v < g.n; ++v) {
+			roots += values[v].load(std::memory_order_relaxed) == v;
+		}
+		if (visited != reachable || roots != componentCount) {
+			std::cerr << "Mismatch: visited " << visited << " of " << reachable << ", components " << roots
+					<< " of " << componentCount << std::endl;
+			return 1;
+		}
+		std::cout << std::setw(7) << threads << std::setw(14) << bfsEdges / bfsSecs / 1e6
+				<< std::setw(13) << ccEdges / ccSecs / 1e6 << std::endl;
+	}
+	return 0;
+}
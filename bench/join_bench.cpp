@@ -0,0 +1,267 @@
+#include "pool.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: WSQJoinBench [workers]
+// Radix-partitioned hash join of a unique-key build table with a Zipf-skewed probe table. Each
+// partition is joined as one task; with splitting, large probe sides are divided further through
+// the workers' deques.
+
+namespace {
+	constexpr int kRadixBits = 8;
+	constexpr size_t kPartitions = size_t{1} << kRadixBits;
+	constexpr uint64_t kEmptyKey = 0;
+
+	struct Tuple {
+		uint64_t key;
+		uint64_t payload;
+	};
+
+	uint64_t mix(uint64_t key) {
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+	size_t partitionOf(uint64_t key) { return mix(key) >> (64 - kRadixBits); }
+
+	// Keys 1..n drawn with P(rank k) proportional to 1/k^theta; theta 0 is uniform.
+	std::vector<uint64_t> zipfKeys(size_t n, size_t count, double theta, uint64_t seed) {
+		std::vector<double> cdf(n);
+		double sum = 0.0;
+		for (size_t k = 0; k < n; ++k) {
+			sum += 1.0 / std::pow(static_cast<double>(k + 1), theta);
+			cdf[k] = sum;
+		}
+		std::mt19937_64 rng(seed);
+		std::uniform_real_distribution<double> unit(0.0, sum);
+		std::vector<uint64_t> keys(count);
+		for (auto &key: keys) {
+			const auto rank = std::lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin();
+			key = static_cast<uint64_t>(std::min<ptrdiff_t>(rank, static_cast<ptrdiff_t>(n) - 1)) + 1;
+		}
+		return keys;
+	}
+
+	// Tuples grouped by partition: partition p is out[offsets[p], offsets[p + 1]).
+	struct Partitioned {
+		std::vector<Tuple> tuples;
+		std::vector<size_t> offsets;
+	};
+
+	// Two-pass parallel radix partition: per-chunk histograms, a partition-major prefix sum, then
+	// each chunk scatters into its own slice of every partition.
+	Partitioned radixPartition(WorkStealingPool &pool, const std::vector<Tuple> &in) {
+		const size_t chunks = 4 * pool.num_workers();
+		const size_t chunkSize = (in.size() + chunks - 1) / chunks;
+		std::vector<std::vector<size_t> > cursor(chunks, std::vector<size_t>(kPartitions));
+		pool.parallel_for(BlockedRange(0, chunks), [&](const BlockedRange &r) {
+			for (auto c = r.begin(); c != r.end(); ++c) {
+				for (auto i = c * chunkSize; i < std::min(in.size(), (c + 1) * chunkSize); ++i) {
+					++cursor[c][partitionOf(in[i].key)];
+				}
+			}
+		});
+		Partitioned out;
+		out.tuples.resize(in.size());
+		out.offsets.resize(kPartitions + 1);
+		size_t next = 0;
+		for (size_t p = 0; p < kPartitions; ++p) {
+			out.offsets[p] = next;
+			for (size_t c = 0; c < chunks; ++c) {
+				const auto count = cursor[c][p];
+				cursor[c][p] = next;
+				next += count;
+			}
+		}
+		out.offsets[kPartitions] = next;
+		pool.parallel_for(BlockedRange(0, chunks), [&](const BlockedRange &r) {
+			for (auto c = r.begin(); c != r.end(); ++c) {
+				for (auto i = c * chunkSize; i < std::min(in.size(), (c + 1) * chunkSize); ++i) {
+					out.tuples[cursor[c][partitionOf(in[i].key)]++] = in[i];
+				}
+			}
+		});
+		return out;
+	}
+
+	// Open-addressing table over one build partition, at most half full.
+	class HashTable {
+	public:
+		explicit HashTable(std::span<const Tuple> build)
+			: mask_{std::bit_ceil(std::max<size_t>(2 * build.size(), 16)) - 1},
+			  slots_(mask_ + 1, Tuple{kEmptyKey, 0}) {
+			for (const auto &t: build) {
+				auto i = mix(t.key) & mask_;
+				while (slots_[i].key != kEmptyKey) {
+					i = (i + 1) & mask_;
+				}
+				slots_[i] = t;
+			}
+		}
+
+		[[nodiscard]]
+		const Tuple *find(uint64_t key) const {
+			for (auto i = mix(key) & mask_; slots_[i].key != kEmptyKey; i = (i + 1) & mask_) {
+				if (slots_[i].key == key) {
+					return &slots_[i];
+				}
+			}
+			return nullptr;
+		}
+
+	private:
+		size_t mask_;
+		std::vector<Tuple> slots_;
+	};
+
+	struct JoinResult {
+		std::atomic<uint64_t> matches{0};
+		std::atomic<uint64_t> checksum{0};
+	};
+
+	void probe(const HashTable &table, std::span<const Tuple> tuples, JoinResult &result) {
+		uint64_t matches = 0, checksum = 0;
+		for (const auto &t: tuples) {
+			if (const auto *hit = table.find(t.key)) {
+				++matches;
+				checksum += hit->payload ^ t.payload;
+			}
+		}
+		result.matches.fetch_add(matches, std::memory_order_relaxed);
+		result.checksum.fetch_add(checksum, std::memory_order_relaxed);
+	}
+
+	// Run f(w) on one thread per entry of placement, pinned there, and join them: a fixed
+	// assignment of work to threads with no pool and no stealing.
+	template<typename F>
+	void runOnThreads(const std::vector<int> &placement, const F &f) {
+		std::vector<std::thread> threads;
+		threads.reserve(placement.size());
+		for (size_t w = 0; w < placement.size(); ++w) {
+			threads.emplace_back([&, w] {
+				(void) pin_current_thread(placement[w]);
+				f(w);
+			});
+		}
+		for (auto &thread: threads) {
+			thread.join();
+		}
+	}
+
+	// Build and probe partitions [first, last). With probe_grain != 0, a probe side longer than
+	// probe_grain is split into a nested parallel_for whose pieces other workers can steal.
+	void joinPartitions(WorkStealingPool &pool, const Partitioned &build, const Partitioned &probeSide,
+	                    size_t first, size_t last, size_t probe_grain, JoinResult &result) {
+		for (auto p = first; p != last; ++p) {
+			const HashTable table(std::span(build.tuples).subspan(
+				build.offsets[p], build.offsets[p + 1] - build.offsets[p]));
+			const auto tuples = std::span(probeSide.tuples).subspan(
+				probeSide.offsets[p], probeSide.offsets[p + 1] - probeSide.offsets[p]);
+			if (probe_grain == 0 || tuples.size() <= probe_grain) {
+				probe(table, tuples, result);
+				continue;
+			}
+			pool.parallel_for(BlockedRange(0, tuples.size(), probe_grain), [&](const BlockedRange &r) {
+				probe(table, tuples.subspan(r.begin(), r.size()), result);
+			});
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	const auto topology = CpuTopology::discover();
+	size_t workers = std::max<size_t>(1, topology.num_cpus());
+	if (argc >= 2) {
+		workers = std::stoul(argv[1]);
+	}
+	const auto placement = topology.plan(workers, Placement::Scatter);
+	WorkStealingPool pool(placement);
+
+	const size_t buildSize = 1 << 20;
+	const size_t probeSize = 1 << 23;
+	const size_t probeGrain = 1 << 14;
+	const int reps = 5;
+
+	std::vector<Tuple> buildTable(buildSize);
+	for (size_t i = 0; i < buildSize; ++i) {
+		buildTable[i] = Tuple{i + 1, mix(i)};
+	}
+	const auto build = radixPartition(pool, buildTable);
+
+	std::cout << "Hash join, " << buildSize << " build x " << probeSize << " probe tuples, " << kPartitions
+			<< " partitions, " << workers << " workers (Mtuples/s of probe input):" << std::endl;
+	std::cout << "  theta  largest  partition   static  stealing  stealing+split" << std::endl;
+	for (const double theta: {0.0, 0.5, 0.9, 1.0, 1.2}) {
+		const auto keys = zipfKeys(buildSize, probeSize, theta, 1);
+		std::vector<Tuple> probeTable(probeSize);
+		for (size_t i = 0; i < probeSize; ++i) {
+			probeTable[i] = Tuple{keys[i], i};
+		}
+
+		const auto t0 = std::chrono::steady_clock::now();
+		const auto probed = radixPartition(pool, probeTable);
+		const auto partitionSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		size_t largest = 0;
+		for (size_t p = 0; p < kPartitions; ++p) {
+			largest = std::max(largest, probed.offsets[p + 1] - probed.offsets[p]);
+		}
+
+		// Millions of probe tuples per second for the build+probe phase, checking every probe
+		// key found its single build match.
+		auto run = [&](const auto &schedule) {
+			double best = 0.0;
+			for (int r = 0; r < reps; ++r) {
+				JoinResult result;
+				const auto start = std::chrono::steady_clock::now();
+				schedule(result);
+				const auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (result.matches.load() != probeSize) {
+					std::cerr << "Join lost tuples: " << result.matches.load() << " of " << probeSize << std::endl;
+					std::exit(1);
+				}
+				best = std::max(best, probeSize / secs / 1e6);
+			}
+			return best;
+		};
+		// Static: thread w joins exactly partitions [w * block, (w + 1) * block), nothing moves.
+		const auto block = (kPartitions + workers - 1) / workers;
+		const auto staticRate = run([&](JoinResult &result) {
+			runOnThreads(placement, [&](size_t w) {
+				joinPartitions(pool, build, probed, std::min(kPartitions, w * block),
+				               std::min(kPartitions, (w + 1) * block), 0, result);
+			});
+		});
+		// Stealing: one pool task per partition, optionally splitting large probe sides.
+		auto perPartition = [&](size_t grain) {
+			return [&, grain](JoinResult &result) {
+				pool.parallel_for(BlockedRange(0, kPartitions), [&](const BlockedRange &range) {
+					joinPartitions(pool, build, probed, range.begin(), range.end(), grain, result);
+				});
+			};
+		};
+		const auto stealingRate = run(perPartition(0));
+		const auto splitRate = run(perPartition(probeGrain));
+
+		std::cout << std::fixed << std::setprecision(2) << std::setw(7) << theta << std::setw(8)
+				<< 100.0 * largest / probeSize << "%" << std::setprecision(1) << std::setw(11)
+				<< probeSize / partitionSecs / 1e6 << std::setw(9) << staticRate << std::setw(10) << stealingRate
+				<< std::setw(16) << splitRate << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,439 @@
+#include "pool.h"
+#include "range_wsq.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	template<typename F>
+	std::chrono::nanoseconds timeIt(int reps, F &&f) {
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < reps; ++r) {
+			f();
+		}
+		auto stop = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start) / reps;
+	}
+
+	// 5-point Jacobi sweep over rows/cols [1, n-1) of an n x n grid.
+	void stencilRows(const std::vector<float> &in, std::vector<float> &out, size_t n,
+	                 size_t row_begin, size_t row_end, size_t col_begin, size_t col_end) {
+		for (size_t i = std::max<size_t>(row_begin, 1); i < std::min(row_end, n - 1); ++i) {
+			for (size_t j = std::max<size_t>(col_begin, 1); j < std::min(col_end, n - 1); ++j) {
+				out[i * n + j] = 0.2f * (in[i * n + j] + in[(i - 1) * n + j] + in[(i + 1) * n + j] +
+				                         in[i * n + j - 1] + in[i * n + j + 1]);
+			}
+		}
+	}
+
+	struct ScoredItem {
+		std::array<float, 16> features;
+		float score;
+	};
+	constexpr std::array<float, 16> kWeights{
+		0.5f, -1.0f, 0.25f, 2.0f, 1.5f, -0.5f, 0.75f, 1.0f,
+		-2.0f, 0.125f, 1.25f, -0.75f, 0.5f, 0.5f, -1.5f, 3.0f
+	};
+	std::atomic<size_t> itemsLeft{0};
+
+	void scoreOne(void *p) {
+		auto *item = static_cast<ScoredItem *>(p);
+		float s = 0.0f;
+		for (size_t k = 0; k < kWeights.size(); ++k) {
+			s += item->features[k] * kWeights[k];
+		}
+		item->score = s;
+		itemsLeft.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	// Feature-major loop over the batch so the compiler vectorizes across items.
+	void scoreBatch(std::span<ScoredItem *const> items) {
+		std::array<float, 64> scores{};
+		for (size_t k = 0; k < kWeights.size(); ++k) {
+			for (size_t i = 0; i < items.size(); ++i) {
+				scores[i] += items[i]->features[k] * kWeights[k];
+			}
+		}
+		for (size_t i = 0; i < items.size(); ++i) {
+			items[i]->score = scores[i];
+		}
+		itemsLeft.fetch_sub(items.size(), std::memory_order_acq_rel);
+	}
+
+	// One thread per entry of placement, started and pinned once. run(f) releases every thread
+	// to call f(t) and returns once all have finished: a fixed assignment of work to threads with
+	// no pool and no stealing, and no thread start-up inside the timed region.
+	class ThreadTeam {
+	public:
+		explicit ThreadTeam(const std::vector<int> &placement) {
+			threads_.reserve(placement.size());
+			for (size_t t = 0; t < placement.size(); ++t) {
+				threads_.emplace_back([this, t, cpu = placement[t]] {
+					(void) pin_current_thread(cpu);
+					loop(t);
+				});
+			}
+		}
+
+		~ThreadTeam() {
+			stop_.store(true, std::memory_order_relaxed);
+			generation_.fetch_add(1, std::memory_order_release);
+			generation_.notify_all();
+			for (auto &thread: threads_) {
+				thread.join();
+			}
+		}
+
+		template<typename F>
+		void run(const F &f) {
+			job_ = [&f](size_t t) { f(t); };
+			remaining_.store(threads_.size(), std::memory_order_relaxed);
+			generation_.fetch_add(1, std::memory_order_release);
+			generation_.notify_all();
+			for (auto left = remaining_.load(std::memory_order_acquire); left != 0;
+			     left = remaining_.load(std::memory_order_acquire)) {
+				remaining_.wait(left, std::memory_order_acquire);
+			}
+		}
+
+	private:
+		void loop(size_t t) {
+			std::uint64_t seen = 0;
+			while (true) {
+				generation_.wait(seen, std::memory_order_acquire);
+				seen = generation_.load(std::memory_order_acquire);
+				if (stop_.load(std::memory_order_relaxed)) {
+					return;
+				}
+				job_(t);
+				if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					remaining_.notify_one();
+				}
+			}
+		}
+
+		std::vector<std::thread> threads_;
+		std::function<void(size_t)> job_;
+		std::atomic<std::uint64_t> generation_{0};
+		std::atomic<size_t> remaining_{0};
+		std::atomic<bool> stop_{false};
+	};
+
+	// CSR matrix with Pareto-distributed row lengths, sorted longest first so heavy rows cluster
+	// the way they do in degree-ordered graphs.
+	struct CsrMatrix {
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<size_t> offsets;
+		std::vector<uint32_t> columns;
+		std::vector<double> values;
+	};
+
+	CsrMatrix skewedCsr(size_t rows, size_t cols, double alpha, uint64_t seed) {
+		std::mt19937_64 rng(seed);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+		std::vector<size_t> lengths(rows);
+		for (auto &len: lengths) {
+			len = std::min(cols, static_cast<size_t>(2.0 / std::pow(1.0 - unit(rng), 1.0 / alpha)));
+		}
+		std::sort(lengths.begin(), lengths.end(), std::greater<>());
+
+		CsrMatrix m;
+		m.rows = rows;
+		m.cols = cols;
+		m.offsets.resize(rows + 1);
+		for (size_t i = 0; i < rows; ++i) {
+			m.offsets[i + 1] = m.offsets[i] + lengths[i];
+		}
+		m.columns.resize(m.offsets[rows]);
+		m.values.resize(m.offsets[rows]);
+		for (size_t k = 0; k < m.columns.size(); ++k) {
+			m.columns[k] = static_cast<uint32_t>(rng() % cols);
+			m.values[k] = unit(rng);
+		}
+		return m;
+	}
+
+	void spmvRows(const CsrMatrix &m, const std::vector<double> &x, std::vector<double> &y,
+	              size_t row_begin, size_t row_end) {
+		for (size_t i = row_begin; i < row_end; ++i) {
+			double acc = 0.0;
+			for (auto k = m.offsets[i]; k != m.offsets[i + 1]; ++k) {
+				acc += m.values[k] * x[m.columns[k]];
+			}
+			y[i] = acc;
+		}
+	}
+
+	// Rows of a CSR matrix, split at the row that halves the nonzeros instead of the rows, so
+	// every leaf carries about the same work however skewed the row lengths are.
+	class NnzRange {
+	public:
+		NnzRange(const std::vector<size_t> &offsets, size_t begin, size_t end, size_t grain_nnz)
+			: offsets_{&offsets}, begin_{begin}, end_{end}, grain_nnz_{grain_nnz} {
+		}
+
+		[[nodiscard]] size_t begin() const { return begin_; }
+		[[nodiscard]] size_t end() const { return end_; }
+
+		[[nodiscard]]
+		bool is_divisible() const {
+			return end_ - begin_ > 1 && (*offsets_)[end_] - (*offsets_)[begin_] > grain_nnz_;
+		}
+
+		NnzRange split() {
+			const auto &offsets = *offsets_;
+			const auto half = offsets[begin_] + (offsets[end_] - offsets[begin_]) / 2;
+			auto mid = static_cast<size_t>(
+				std::upper_bound(offsets.begin() + begin_ + 1, offsets.begin() + end_, half) - offsets.begin());
+			// One heavy row can hold more than half; keep both parts non-empty.
+			mid = std::clamp(mid, begin_ + 1, end_ - 1);
+			NnzRange upper = *this;
+			upper.begin_ = mid;
+			end_ = mid;
+			return upper;
+		}
+
+	private:
+		const std::vector<size_t> *offsets_;
+		size_t begin_;
+		size_t end_;
+		size_t grain_nnz_;
+	};
+}
+
+int main(int argc, char *argv[]) {
+	const auto topology = CpuTopology::discover();
+	size_t workers = std::max<size_t>(1, topology.num_cpus());
+	if (argc >= 2) {
+		workers = std::stoul(argv[1]);
+	}
+
+	std::cout << "WorkStealingPool Benchmarks (" << workers << " workers):" << std::endl;
+	const auto placement = topology.plan(workers, Placement::Scatter);
+	WorkStealingPool pool(placement);
+
+	// ---------------------------------------------------
+	// 1. 2D stencil: serial vs. parallel_for over BlockedRange2d
+	// ---------------------------------------------------
+	{
+		const size_t n = 2048;
+		const int reps = 10;
+		std::vector<float> in(n * n, 1.0f), out(n * n, 0.0f);
+
+		auto serial = timeIt(reps, [&] { stencilRows(in, out, n, 0, n, 0, n); });
+		auto parallel = timeIt(reps, [&] {
+			// Split columns on out's actual cache lines; vector storage need not be line-aligned.
+			pool.parallel_for(BlockedRange2d<float>(out.data(), n, 0, n, 16, 0, n, 256),
+			                  [&](const BlockedRange2d<float> &r) {
+				                  stencilRows(in, out, n, r.rows().begin(), r.rows().end(),
+				                              r.cols().begin(), r.cols().end());
+			                  });
+		});
+
+		std::cout << "2D stencil " << n << "x" << n << ":\n";
+		std::cout << "    serial:   " << serial << "\n";
+		std::cout << "    parallel: " << parallel << "\n";
+		std::cout << "    speedup:  " << static_cast<double>(serial.count()) / parallel.count()
+				<< std::endl;
+	}
+
+	// ---------------------------------------------------
+	// 2. Write-heavy map: unaligned vs. cache-line aligned chunks
+	// ---------------------------------------------------
+	{
+		const size_t n = 1 << 22;
+		const size_t grain = 40; // Not a multiple of a cache line of floats.
+		const int reps = 10;
+		const size_t line = cache_line_elements<float>();
+		std::vector<float> in(n, 1.0f), out_storage(n + line, 0.0f);
+		// Start the output mid-line so unaligned chunk edges always split a line.
+		const size_t skew = (line / 2 + line - cache_line_offset(out_storage.data())) % line;
+		std::span<float> out(out_storage.data() + skew, n);
+
+		auto map = [&](size_t i) {
+			for (int k = 0; k < 8; ++k) {
+				out[i] += in[i] * static_cast<float>(k);
+			}
+		};
+		auto unaligned = timeIt(reps, [&] { pool.parallel_for(0, n, grain, map); });
+		auto aligned = timeIt(reps, [&] { pool.parallel_for(out, grain, map); });
+
+		std::cout << "Write-heavy map, " << n << " floats, grain " << grain << ":\n";
+		std::cout << "    unaligned chunks: " << unaligned << "\n";
+		std::cout << "    aligned chunks:   " << aligned << std::endl;
+	}
+
+	// ---------------------------------------------------
+	// 3. Same-kind tasks: per-task dispatch vs. batched kernel
+	// ---------------------------------------------------
+	{
+		const size_t n = WorkStealingPool::kQueueCapacity - 1;
+		const int reps = 200;
+		std::vector<ScoredItem> items(n);
+		for (size_t i = 0; i < n; ++i) {
+			items[i].features.fill(static_cast<float>(i % 7));
+		}
+
+		// Spawn from a worker so the tasks land on its local deque, then wait without helping.
+		auto run = [&](auto makeTask) {
+			itemsLeft.store(n, std::memory_order_release);
+			pool.submit([&] {
+				for (auto &item: items) {
+					pool.submit(makeTask(&item));
+				}
+			});
+			while (itemsLeft.load(std::memory_order_acquire) != 0) {
+				std::this_thread::yield();
+			}
+		};
+		auto perTask = timeIt(reps, [&] { run([](ScoredItem *item) { return Task{&scoreOne, item}; }); });
+		auto batched = timeIt(reps, [&] { run(BatchTask<ScoredItem, &scoreBatch, 64>::make); });
+
+		std::cout << "Scoring " << n << " items:\n";
+		std::cout << "    per-task dispatch: " << perTask << "\n";
+		std::cout << "    batched kernel:    " << batched << std::endl;
+	}
+
+	// ---------------------------------------------------
+	// 4. Floating-point sum: parallel_reduce vs. parallel_deterministic_reduce
+	// ---------------------------------------------------
+	{
+		const size_t n = 1 << 24;
+		const size_t grain = 1 << 12;
+		const int reps = 20;
+		std::vector<double> values(n);
+		std::mt19937_64 rng(1);
+		std::uniform_real_distribution<double> mantissa(1.0, 2.0);
+		for (auto &v: values) {
+			v = std::ldexp(mantissa(rng), static_cast<int>(rng() % 60) - 30);
+		}
+		const auto body = [&](const BlockedRange &r, double acc) {
+			for (auto i = r.begin(); i != r.end(); ++i) {
+				acc += values[i];
+			}
+			return acc;
+		};
+		const auto join = [](double a, double b) { return a + b; };
+		const BlockedRange range(0, n, grain);
+
+		// Distinct results over the timed runs show the run-to-run drift.
+		std::set<double> reduceResults, deterministicResults;
+		auto reduce = timeIt(reps, [&] {
+			reduceResults.insert(pool.parallel_reduce(range, 0.0, body, join));
+		});
+		auto deterministic = timeIt(reps, [&] {
+			deterministicResults.insert(pool.parallel_deterministic_reduce(range, 0.0, body, join));
+		});
+
+		std::cout << "Sum of " << n << " doubles, grain " << grain << ":\n";
+		std::cout << "    parallel_reduce:               " << reduce << " (" << reduceResults.size()
+				<< " distinct results)\n";
+		std::cout << "    parallel_deterministic_reduce: " << deterministic << " ("
+				<< deterministicResults.size() << " distinct results)" << std::endl;
+	}
+
+	// ---------------------------------------------------
+	// 5. Skewed SpMV: static row blocks vs. parallel_for vs. RangeWorkStealingQueue splitting
+	// ---------------------------------------------------
+	{
+		const size_t rows = 1 << 18;
+		const size_t cols = 1 << 16;
+		const int reps = 20;
+		const auto m = skewedCsr(rows, cols, 1.1, 1);
+		std::vector<double> x(cols, 1.0), y(rows);
+		const auto nnz = m.offsets[rows];
+
+		// Static: thread t runs exactly rows [t * block, (t + 1) * block), nothing moves.
+		const auto block = (rows + workers - 1) / workers;
+		auto blockOf = [&](size_t t) {
+			return std::pair{std::min(rows, t * block), std::min(rows, (t + 1) * block)};
+		};
+		ThreadTeam team(placement);
+		auto staticRows = timeIt(reps, [&] {
+			team.run([&](size_t t) {
+				const auto [begin, end] = blockOf(t);
+				spmvRows(m, x, y, begin, end);
+			});
+		});
+
+		const size_t rowGrain = 256;
+		auto stealing = timeIt(reps, [&] {
+			pool.parallel_for(BlockedRange(0, rows, rowGrain), [&](const BlockedRange &r) {
+				spmvRows(m, x, y, r.begin(), r.end());
+			});
+		});
+		const size_t nnzGrain = 1 << 14;
+		auto nnzSplit = timeIt(reps, [&] {
+			pool.parallel_for(NnzRange(m.offsets, 0, rows, nnzGrain), [&](const NnzRange &r) {
+				spmvRows(m, x, y, r.begin(), r.end());
+			});
+		});
+
+		// Range-splitting deques: each thread starts with its static block as one range, pops
+		// rangeGrain rows at a time from it, and once it runs dry steals the upper half of the
+		// oldest range in another thread's deque. Runs on the same pinned team as the static schedule.
+		const std::uint32_t rangeGrain = 64;
+		std::vector<std::unique_ptr<RangeWorkStealingQueue<64> > > ranges(workers);
+		for (auto &q: ranges) {
+			q = std::make_unique<RangeWorkStealingQueue<64> >();
+		}
+		auto rangeSplit = timeIt(reps, [&] {
+			std::atomic<size_t> rowsLeft{rows};
+			team.run([&](size_t t) {
+				auto &own = *ranges[t];
+				const auto [begin, end] = blockOf(t);
+				own.push(IndexRange{static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end)});
+				size_t victim = t;
+				while (rowsLeft.load(std::memory_order_acquire) != 0) {
+					if (auto r = own.pop(rangeGrain)) {
+						spmvRows(m, x, y, r->begin, r->end);
+						rowsLeft.fetch_sub(r->size(), std::memory_order_acq_rel);
+						continue;
+					}
+					victim = (victim + 1) % workers;
+					if (victim == t) {
+						// A full round of victims came up empty.
+						std::this_thread::yield();
+						continue;
+					}
+					if (auto r = ranges[victim]->steal()) {
+						own.push(*r);
+					}
+				}
+			});
+		});
+
+		// Largest share of the nonzeros any static block holds.
+		size_t heaviest = 0;
+		for (size_t t = 0; t < workers; ++t) {
+			const auto [begin, end] = blockOf(t);
+			heaviest = std::max(heaviest, m.offsets[end] - m.offsets[begin]);
+		}
+		auto report = [&](const std::string &label, std::chrono::nanoseconds t) {
+			std::cout << "    " << std::left << std::setw(36) << label + ":" << std::right << t << " ("
+					<< static_cast<double>(nnz) / static_cast<double>(t.count()) << " Gnnz/s)\n";
+		};
+		std::cout << "SpMV " << rows << " rows, " << nnz << " nonzeros, longest row " << m.offsets[1]
+				<< ", heaviest static block " << 100.0 * heaviest / nnz << "% of nonzeros:\n";
+		report("static blocks", staticRows);
+		report("parallel_for, " + std::to_string(rowGrain) + " rows", stealing);
+		report("parallel_for, nnz-split ranges", nnzSplit);
+		report("RangeWorkStealingQueue, " + std::to_string(rangeGrain) + " rows", rangeSplit);
+		std::cout << std::flush;
+	}
+	return 0;
+}
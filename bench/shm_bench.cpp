@@ -0,0 +1,84 @@
+#include "shm_wsq.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+	using shared_queue = SharedWorkStealingQueue<long long, (1 << 16)>;
+}
+
+int main(int argc, char *argv[]) {
+	int numThieves = 2;
+	if (argc >= 2) {
+		numThieves = std::stoi(argv[1]);
+	}
+
+	const long long iters = 10'000'000;
+	const std::string name = "/wsq_bench_" + std::to_string(::getpid());
+
+	std::cout << "SharedWorkStealingQueue Benchmarks:" << std::endl;
+
+	// ---------------------------------------------------
+	// 1. Cross-process steal throughput: one producer process, numThieves thief processes
+	// ---------------------------------------------------
+	{
+		// Queue 0 is the producer's; queue i + 1 carries thief i's steal count back.
+		auto queues = SharedQueueSet<shared_queue>::create(name, numThieves + 1);
+
+		std::vector<pid_t> thieves;
+		for (int tId = 0; tId < numThieves; ++tId) {
+			const pid_t pid = ::fork();
+			if (pid == -1) {
+				perror("fork");
+				return 1;
+			}
+			if (pid == 0) {
+				auto shared = SharedQueueSet<shared_queue>::open(name);
+				long long stolen = 0;
+				while (true) {
+					if (auto val = shared[0].steal()) {
+						if (*val < 0) {
+							break;
+						}
+						++stolen;
+					}
+				}
+				shared[tId + 1].emplace(stolen);
+				::_exit(0);
+			}
+			thieves.push_back(pid);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		for (long long i = 0; i < iters; ++i) {
+			queues[0].emplace(i);
+		}
+		while (!queues[0].empty()) {
+		}
+		auto stop = std::chrono::steady_clock::now();
+		for (int tId = 0; tId < numThieves; ++tId) {
+			queues[0].emplace(-1);
+		}
+
+		long long totalStolen = 0;
+		for (int tId = 0; tId < numThieves; ++tId) {
+			::waitpid(thieves[tId], nullptr, 0);
+			if (auto stolen = queues[tId + 1].pop()) {
+				totalStolen += *stolen;
+			}
+		}
+		if (totalStolen != iters) {
+			std::cerr << "Mismatch detected: stolen=" << totalStolen << " iters=" << iters << std::endl;
+			return 1;
+		}
+
+		std::cout << "Cross-process steal throughput (" << numThieves << " thief processes): "
+				<< iters * 1000000 /
+				std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count()
+				<< " ops/ms" << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,97 @@
+#include "scheduler_sim.h"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Usage: WSQSim [trace_file|-] [emplace_ns pop_ns steal_ns]
+// Without a trace file, records a sample divide-and-conquer DAG from a WorkStealingPool.
+// Operation costs default to QueueOpCosts; pass the per-op costs printed by WSQBench.
+
+namespace {
+	void spin(std::chrono::nanoseconds d) {
+		auto until = std::chrono::steady_clock::now() + d;
+		while (std::chrono::steady_clock::now() < until) {
+		}
+	}
+
+	void divide(WorkStealingPool &pool, DagRecorder &recorder, std::atomic<size_t> &pending, int depth) {
+		spin(std::chrono::microseconds(2));
+		if (depth == 0) {
+			spin(std::chrono::microseconds(20));
+		} else {
+			for (int k = 0; k < 2; ++k) {
+				pending.fetch_add(1, std::memory_order_relaxed);
+				recorder.spawn(pool, [&pool, &recorder, &pending, depth] {
+					divide(pool, recorder, pending, depth - 1);
+				});
+			}
+		}
+		pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+	TaskDag recordSample() {
+		WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()));
+		DagRecorder recorder;
+		std::atomic<size_t> pending{1};
+		recorder.spawn(pool, [&] { divide(pool, recorder, pending, 12); });
+		while (pending.load(std::memory_order_acquire) != 0) {
+			std::this_thread::yield();
+		}
+		return recorder.take();
+	}
+
+	const char *name(VictimPolicy p) {
+		switch (p) {
+			case VictimPolicy::Random: return "random";
+			case VictimPolicy::RoundRobin: return "round-robin";
+			case VictimPolicy::MostLoaded: return "most-loaded";
+		}
+		return "?";
+	}
+}
+
+int main(int argc, char *argv[]) {
+	TaskDag dag;
+	if (argc >= 2 && std::string(argv[1]) != "-") {
+		std::ifstream in(argv[1]);
+		if (!in) {
+			std::cerr << "cannot open " << argv[1] << std::endl;
+			return 1;
+		}
+		dag = TaskDag::load(in);
+	} else {
+		dag = recordSample();
+	}
+
+	QueueOpCosts costs;
+	if (argc >= 5) {
+		costs = {std::stoull(argv[2]), std::stoull(argv[3]), std::stoull(argv[4])};
+	}
+
+	SchedulerSimulator sim(dag, costs);
+	std::cout << "Simulating " << dag.nodes.size() << " tasks (emplace " << costs.emplace_ns
+			<< "ns, pop " << costs.pop_ns << "ns, steal " << costs.steal_ns << "ns):" << std::endl;
+	std::cout << std::setw(8) << "workers" << std::setw(13) << "victim" << std::setw(7) << "batch"
+			<< std::setw(10) << "capacity" << std::setw(16) << "makespan (ns)" << std::setw(10) << "speedup"
+			<< std::setw(9) << "steals" << std::setw(14) << "failed steals" << std::endl;
+
+	const auto serial = sim.run({1, VictimPolicy::Random, 1, WorkStealingPool::kQueueCapacity});
+	for (size_t workers: {1, 2, 4, 8, 16}) {
+		for (auto victim: {VictimPolicy::Random, VictimPolicy::RoundRobin, VictimPolicy::MostLoaded}) {
+			for (size_t batch: {1, 4}) {
+				for (size_t capacity: {size_t{64}, WorkStealingPool::kQueueCapacity}) {
+					const auto r = sim.run({workers, victim, batch, capacity});
+					std::cout << std::setw(8) << workers << std::setw(13) << name(victim) << std::setw(7) << batch
+							<< std::setw(10) << capacity << std::setw(16) << r.makespan_ns
+							<< std::setw(10) << std::fixed << std::setprecision(2)
+							<< static_cast<double>(serial.makespan_ns) / r.makespan_ns
+							<< std::setw(9) << r.steals << std::setw(14) << r.failed_steals << std::endl;
+				}
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include "runtime.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: WSQStartupBench [max_workers]
+// Startup cost of a private WorkStealingPool per component vs. views on the shared Runtime.
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	std::chrono::nanoseconds since(Clock::time_point start) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+	}
+
+	// Wait, without helping, until the submitted task has run on a worker.
+	template<typename Submit>
+	std::chrono::nanoseconds firstTask(Clock::time_point start, Submit &&submit) {
+		std::atomic<bool> ran{false};
+		std::chrono::nanoseconds latency{};
+		submit([&] {
+			latency = since(start);
+			ran.store(true, std::memory_order_release);
+		});
+		while (!ran.load(std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+		return latency;
+	}
+}
+
+int main(int argc, char *argv[]) {
+	size_t maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+	if (argc >= 2) {
+		maxWorkers = std::stoul(argv[1]);
+	}
+	const int reps = 20;
+
+	std::cout << "Startup latency (" << reps << " reps):" << std::endl;
+
+	// ---------------------------------------------------
+	// 1. Private pool per component: construction and time to first task
+	// ---------------------------------------------------
+	for (size_t workers = 1; workers <= maxWorkers; workers *= 2) {
+		std::chrono::nanoseconds construct{}, first{}, destroy{};
+		for (int r = 0; r < reps; ++r) {
+			auto start = Clock::now();
+			auto pool = std::make_unique<WorkStealingPool>(workers);
+			construct += since(start);
+			first += firstTask(start, [&](auto f) { pool->submit(std::move(f)); });
+			start = Clock::now();
+			pool.reset();
+			destroy += since(start);
+		}
+		std::cout << "    private pool, " << workers << " workers: construct " << construct / reps
+				<< ", first task " << first / reps << ", destroy " << destroy / reps << std::endl;
+	}
+
+	// ---------------------------------------------------
+	// 2. Shared runtime: first use, then per-component views
+	// ---------------------------------------------------
+	{
+		Runtime::configure(maxWorkers);
+		auto start = Clock::now();
+		auto &pool = Runtime::pool();
+		const auto construct = since(start);
+		const auto first = firstTask(start, [&](auto f) { pool.submit(std::move(f)); });
+		std::cout << "    shared runtime, first use (" << pool.num_workers() << " workers): construct "
+				<< construct << ", first task " << first << std::endl;
+
+		std::chrono::nanoseconds viewConstruct{}, viewFirst{};
+		for (int r = 0; r < reps; ++r) {
+			start = Clock::now();
+			auto view = Runtime::view(1);
+			viewConstruct += since(start);
+			viewFirst += firstTask(start, [&](auto f) { view->submit(std::move(f)); });
+		}
+		std::cout << "    shared runtime, view (1 slot): construct " << viewConstruct / reps
+				<< ", first task " << viewFirst / reps << std::endl;
+	}
+	return 0;
+}
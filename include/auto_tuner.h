@@ -0,0 +1,193 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+
+// Limits the tuner keeps each knob within.
+struct TunerBounds {
+	size_t min_grain = 1;
+	size_t max_grain = 1 << 16;
+	size_t min_steal_batch = 1;
+	size_t max_steal_batch = 32;
+	size_t min_capacity = 1 << 8;
+	size_t max_capacity = WorkStealingPool::kQueueCapacity;
+};
+
+// What the tuner observed over one update() window.
+struct TunerSample {
+	double steal_success = 0.0; // steals / steal attempts
+	double occupancy = 0.0;     // mean tasks queued per worker
+	double idle_fraction = 0.0; // worker time spent finding nothing to run
+	size_t peak_queue = 0;      // largest single queue seen so far
+};
+
+// Adjusts a pool's tuning knobs from its PoolStats, one multiplicative step per update():
+// - grain for parallel_for: halved while workers sit idle with empty queues (too little
+//   parallelism exposed), doubled while queues stay deep and nobody idles (tasks too fine);
+// - the pool's steal batch: doubled while steals mostly succeed and are frequent relative to
+//   the tasks run, halved while most steal attempts fail;
+// - queue capacity: twice the peak queue depth observed, rounded to a power of two. Pool queues
+//   are sized at compile time, so this is the value to use for queues created from now on.
+// Call update() periodically, or start() a background thread that does.
+class AutoTuner {
+public:
+	explicit AutoTuner(WorkStealingPool &pool, TunerBounds bounds = {}, size_t initial_grain = 64)
+		: pool_{pool},
+		  bounds_{bounds},
+		  grain_{std::clamp(initial_grain, bounds.min_grain, bounds.max_grain)},
+		  capacity_{std::clamp(WorkStealingPool::kQueueCapacity, bounds.min_capacity, bounds.max_capacity)},
+		  last_{pool.stats()},
+		  last_time_{Clock::now()} {
+		pool_.set_steal_batch(std::clamp(pool_.steal_batch(), bounds.min_steal_batch, bounds.max_steal_batch));
+	}
+
+	~AutoTuner() { stop(); }
+
+	AutoTuner(const AutoTuner &) = delete;
+	AutoTuner &operator=(const AutoTuner &) = delete;
+
+	[[nodiscard]]
+	size_t grain() const noexcept { return grain_.load(std::memory_order_relaxed); }
+
+	[[nodiscard]]
+	size_t steal_batch() const noexcept { return pool_.steal_batch(); }
+
+	[[nodiscard]]
+	size_t queue_capacity() const noexcept { return capacity_.load(std::memory_order_relaxed); }
+
+	// pool.parallel_for with the current grain.
+	template<typename F>
+		requires std::is_invocable_v<const F &, size_t>
+	void parallel_for(size_t begin, size_t end, const F &f) {
+		pool_.parallel_for(begin, end, grain(), f);
+	}
+
+	// Sample the pool and move each knob by at most one step. Not thread-safe against itself.
+	TunerSample update() {
+		const auto now = Clock::now();
+		const auto stats = pool_.stats();
+		const auto delta = stats - last_;
+		const auto window_ns = std::chrono::duration<double, std::nano>(now - last_time_).count();
+		last_ = stats;
+		last_time_ = now;
+
+		TunerSample sample;
+		size_t queued = 0;
+		for (size_t w = 0; w < pool_.num_workers(); ++w) {
+			const auto size = pool_.queue_size(w);
+			queued += size;
+			peak_queue_ = std::max(peak_queue_, size);
+		}
+		sample.peak_queue = peak_queue_;
+		sample.occupancy = static_cast<double>(queued) / static_cast<double>(pool_.num_workers());
+		if (delta.steal_attempts != 0)
+			sample.steal_success = static_cast<double>(delta.steals) / static_cast<double>(delta.steal_attempts);
+		if (window_ns > 0)
+			sample.idle_fraction = std::min(
+				1.0, static_cast<double>(delta.idle_ns) / (window_ns * static_cast<double>(pool_.num_workers())));
+
+		// Only tune on windows where the pool actually ran something.
+		if (delta.tasks_run == 0)
+			return sample;
+
+		auto grain = this->grain();
+		if (sample.idle_fraction > kHighIdle && sample.occupancy < kLowOccupancy)
+			grain = std::max(grain / 2, bounds_.min_grain);
+		else if (sample.idle_fraction < kLowIdle && sample.occupancy > kHighOccupancy)
+			grain = std::min(grain * 2, bounds_.max_grain);
+		grain_.store(grain, std::memory_order_relaxed);
+
+		auto batch = pool_.steal_batch();
+		const auto steal_ratio = static_cast<double>(delta.steals) / static_cast<double>(delta.tasks_run);
+		if (delta.steal_attempts >= kMinAttempts) {
+			if (sample.steal_success > kHighSuccess && steal_ratio > kFrequentSteals)
+				batch = std::min(batch * 2, bounds_.max_steal_batch);
+			else if (sample.steal_success < kLowSuccess)
+				batch = std::max(batch / 2, bounds_.min_steal_batch);
+		}
+		pool_.set_steal_batch(batch);
+
+		capacity_.store(std::clamp(std::bit_ceil(std::max<size_t>(2 * peak_queue_, 1)),
+		                           bounds_.min_capacity, bounds_.max_capacity), std::memory_order_relaxed);
+		return sample;
+	}
+
+	// Call update() every period on a background thread until stop().
+	void start(std::chrono::milliseconds period) {
+		stop();
+		running_ = true;
+		thread_ = std::thread([this, period] {
+			std::unique_lock lock(mutex_);
+			while (!cv_.wait_for(lock, period, [this] { return !running_; }))
+				update();
+		});
+	}
+
+	void stop() {
+		{
+			std::lock_guard lock(mutex_);
+			running_ = false;
+		}
+		cv_.notify_all();
+		if (thread_.joinable())
+			thread_.join();
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr double kHighIdle = 0.2;
+	static constexpr double kLowIdle = 0.05;
+	static constexpr double kLowOccupancy = 1.0;
+	static constexpr double kHighOccupancy = 8.0;
+	static constexpr double kHighSuccess = 0.5;
+	static constexpr double kLowSuccess = 0.1;
+	static constexpr double kFrequentSteals = 0.25;
+	static constexpr std::uint64_t kMinAttempts = 16;
+
+	WorkStealingPool &pool_;
+	TunerBounds bounds_;
+	std::atomic<size_t> grain_;
+	std::atomic<size_t> capacity_;
+	PoolStats last_;
+	Clock::time_point last_time_;
+	size_t peak_queue_ = 0;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool running_ = false;
+	std::thread thread_;
+};
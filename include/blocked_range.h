@@ -0,0 +1,245 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+// Number of T that fit in one cache line, used to align split points of ranges over T arrays.
+template<typename T>
+[[nodiscard]]
+constexpr size_t cache_line_elements() noexcept {
+	return std::max<size_t>(1, kCacheLineSize / sizeof(T));
+}
+
+// Elements of T between the start of p's cache line and p. Adding it to an index into p makes
+// multiples of cache_line_elements<T>() land on cache-line boundaries.
+template<typename T>
+[[nodiscard]]
+size_t cache_line_offset(const T *p) noexcept {
+	if constexpr (kCacheLineSize % sizeof(T) != 0) {
+		return 0;
+	} else {
+		return reinterpret_cast<std::uintptr_t>(p) % kCacheLineSize / sizeof(T);
+	}
+}
+
+// Ranges the pool can divide recursively. split() keeps the lower part in *this and returns the
+// upper part; it is only called when is_divisible() holds.
+template<typename R>
+concept SplittableRange = std::copy_constructible<R> && requires(R r, const R cr) {
+	{ cr.is_divisible() } -> std::convertible_to<bool>;
+	{ r.split() } -> std::same_as<R>;
+};
+
+// One-dimensional range [begin, end). Split points p satisfy (p + phase) % align == 0, so chunks
+// of an array whose element 0 sits phase elements into an align-element line never share a line;
+// grain is rounded up to a multiple of align.
+class BlockedRange {
+public:
+	constexpr BlockedRange(size_t begin, size_t end, size_t grain = 1, size_t align = 1,
+	                       size_t phase = 0) noexcept
+		: begin_{begin},
+		  end_{std::max(begin, end)},
+		  align_{std::max<size_t>(align, 1)},
+		  grain_{(std::max<size_t>(grain, 1) + align_ - 1) / align_ * align_},
+		  phase_{phase % align_} {
+	}
+
+	[[nodiscard]] constexpr size_t begin() const noexcept { return begin_; }
+	[[nodiscard]] constexpr size_t end() const noexcept { return end_; }
+	[[nodiscard]] constexpr size_t size() const noexcept { return end_ - begin_; }
+	[[nodiscard]] constexpr bool empty() const noexcept { return end_ == begin_; }
+	[[nodiscard]] constexpr size_t grain() const noexcept { return grain_; }
+	[[nodiscard]] constexpr size_t align() const noexcept { return align_; }
+
+	[[nodiscard]]
+	constexpr bool is_divisible() const noexcept { return size() > grain_; }
+
+	constexpr BlockedRange split() noexcept {
+		assert(is_divisible());
+		const auto mid = split_point();
+		BlockedRange upper = *this;
+		upper.begin_ = mid;
+		end_ = mid;
+		return upper;
+	}
+
+private:
+	// Midpoint rounded down (or up) to a line boundary, computed in phase-shifted coordinates.
+	// size() > grain_ >= align_ guarantees such a boundary lies strictly inside the range.
+	[[nodiscard]]
+	constexpr size_t split_point() const noexcept {
+		const auto mid = begin_ + size() / 2;
+		if (align_ == 1)
+			return mid;
+		const auto down = (mid + phase_) / align_ * align_;
+		if (down > begin_ + phase_)
+			return down - phase_;
+		const auto up = down + align_;
+		return up < end_ + phase_ ? up - phase_ : mid;
+	}
+
+	size_t begin_;
+	size_t end_;
+	size_t align_;
+	size_t grain_;
+	size_t phase_;
+};
+
+// Phase of column 0 for a row-major array of T starting at data, for BlockedRange's phase
+// argument. Every row shares that phase only if row_stride spans whole cache lines.
+template<typename T>
+[[nodiscard]]
+size_t row_phase(const T *data, [[maybe_unused]] size_t row_stride) noexcept {
+	if constexpr (kCacheLineSize % sizeof(T) == 0)
+		assert(row_stride % cache_line_elements<T>() == 0 && "row stride must be whole cache lines");
+	return cache_line_offset(data);
+}
+
+// Row-major 2D range over an array of T. Splits along the longest divisible dimension; column
+// split points are multiples of a cache line of T so adjacent tasks don't false-share output
+// rows. The index-only constructors assume every row starts on a cache line; the ones taking
+// data place the splits on the real lines of that array, whose row_stride (in elements) must be
+// a whole number of lines.
+template<typename T>
+class BlockedRange2d {
+public:
+	constexpr BlockedRange2d(size_t row_begin, size_t row_end, size_t row_grain,
+	                         size_t col_begin, size_t col_end, size_t col_grain = 1) noexcept
+		: rows_{row_begin, row_end, row_grain},
+		  cols_{col_begin, col_end, col_grain, cache_line_elements<T>()} {
+	}
+
+	constexpr BlockedRange2d(size_t row_begin, size_t row_end,
+	                         size_t col_begin, size_t col_end) noexcept
+		: BlockedRange2d(row_begin, row_end, 1, col_begin, col_end) {
+	}
+
+	BlockedRange2d(const T *data, size_t row_stride,
+	               size_t row_begin, size_t row_end, size_t row_grain,
+	               size_t col_begin, size_t col_end, size_t col_grain = 1) noexcept
+		: rows_{row_begin, row_end, row_grain},
+		  cols_{col_begin, col_end, col_grain, cache_line_elements<T>(), row_phase(data, row_stride)} {
+	}
+
+	[[nodiscard]] constexpr const BlockedRange &rows() const noexcept { return rows_; }
+	[[nodiscard]] constexpr const BlockedRange &cols() const noexcept { return cols_; }
+	[[nodiscard]] constexpr size_t size() const noexcept { return rows_.size() * cols_.size(); }
+
+	[[nodiscard]]
+	constexpr bool is_divisible() const noexcept {
+		return rows_.is_divisible() || cols_.is_divisible();
+	}
+
+	constexpr BlockedRange2d split() noexcept {
+		BlockedRange2d upper = *this;
+		if (split_rows())
+			upper.rows_ = rows_.split();
+		else
+			upper.cols_ = cols_.split();
+		return upper;
+	}
+
+private:
+	[[nodiscard]]
+	constexpr bool split_rows() const noexcept {
+		if (!cols_.is_divisible())
+			return true;
+		return rows_.is_divisible() && rows_.size() >= cols_.size();
+	}
+
+	BlockedRange rows_;
+	BlockedRange cols_;
+};
+
+// Pages x rows x cols over an array of T, with the same splitting rules and alignment
+// preconditions as BlockedRange2d. Pages are assumed to be a whole number of rows apart.
+template<typename T>
+class BlockedRange3d {
+public:
+	constexpr BlockedRange3d(size_t page_begin, size_t page_end, size_t page_grain,
+	                         size_t row_begin, size_t row_end, size_t row_grain,
+	                         size_t col_begin, size_t col_end, size_t col_grain = 1) noexcept
+		: pages_{page_begin, page_end, page_grain},
+		  rows_{row_begin, row_end, row_grain},
+		  cols_{col_begin, col_end, col_grain, cache_line_elements<T>()} {
+	}
+
+	BlockedRange3d(const T *data, size_t row_stride,
+	               size_t page_begin, size_t page_end, size_t page_grain,
+	               size_t row_begin, size_t row_end, size_t row_grain,
+	               size_t col_begin, size_t col_end, size_t col_grain = 1) noexcept
+		: pages_{page_begin, page_end, page_grain},
+		  rows_{row_begin, row_end, row_grain},
+		  cols_{col_begin, col_end, col_grain, cache_line_elements<T>(), row_phase(data, row_stride)} {
+	}
+
+	constexpr BlockedRange3d(size_t page_begin, size_t page_end,
+	                         size_t row_begin, size_t row_end,
+	                         size_t col_begin, size_t col_end) noexcept
+		: BlockedRange3d(page_begin, page_end, 1, row_begin, row_end, 1, col_begin, col_end) {
+	}
+
+	[[nodiscard]] constexpr const BlockedRange &pages() const noexcept { return pages_; }
+	[[nodiscard]] constexpr const BlockedRange &rows() const noexcept { return rows_; }
+	[[nodiscard]] constexpr const BlockedRange &cols() const noexcept { return cols_; }
+
+	[[nodiscard]]
+	constexpr size_t size() const noexcept { return pages_.size() * rows_.size() * cols_.size(); }
+
+	[[nodiscard]]
+	constexpr bool is_divisible() const noexcept {
+		return pages_.is_divisible() || rows_.is_divisible() || cols_.is_divisible();
+	}
+
+	constexpr BlockedRange3d split() noexcept {
+		BlockedRange3d upper = *this;
+		BlockedRange *longest = nullptr;
+		BlockedRange *upper_dim = nullptr;
+		for (auto [dim, up] : {std::pair{&pages_, &upper.pages_},
+		                       std::pair{&rows_, &upper.rows_},
+		                       std::pair{&cols_, &upper.cols_}}) {
+			if (dim->is_divisible() && (!longest || dim->size() > longest->size())) {
+				longest = dim;
+				upper_dim = up;
+			}
+		}
+		assert(longest);
+		*upper_dim = longest->split();
+		return upper;
+	}
+
+private:
+	BlockedRange pages_;
+	BlockedRange rows_;
+	BlockedRange cols_;
+};
@@ -0,0 +1,361 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+
+template<typename T>
+class Future;
+
+// Shared state behind a Promise/Future pair: one allocation, reference counted, with no lock.
+// stage_ goes Empty -> HasContinuation -> Ready or Empty -> Ready; whichever of set() and attach()
+// comes second submits the continuation, so a value set on a worker queues it on that worker's
+// own WorkStealingQueue.
+template<typename T>
+class FutureState {
+public:
+	using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+	explicit FutureState(WorkStealingPool &pool) : pool_{pool} {
+	}
+
+	FutureState(const FutureState &) = delete;
+	FutureState &operator=(const FutureState &) = delete;
+
+	[[nodiscard]]
+	WorkStealingPool &pool() const noexcept { return pool_; }
+
+	void retain() noexcept { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+	void release() noexcept {
+		if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	[[nodiscard]]
+	bool ready() const noexcept { return stage_.load(std::memory_order_acquire) == kReady; }
+
+	template<typename... Args>
+	void set(Args &&... args) {
+		value_.emplace(std::forward<Args>(args)...);
+		if (stage_.exchange(kReady, std::memory_order_acq_rel) == kHasContinuation)
+			pool_.submit(continuation_);
+	}
+
+	// Run task once the value is set (right away if it already is). At most one continuation.
+	void attach(Task task) {
+		continuation_ = task;
+		auto expected = kEmpty;
+		if (!stage_.compare_exchange_strong(expected, kHasContinuation, std::memory_order_acq_rel,
+		                                    std::memory_order_acquire))
+			pool_.submit(task);
+	}
+
+	// Only valid once ready(); the value is moved out, so call at most once.
+	[[nodiscard]]
+	Value take() { return std::move(*value_); }
+
+private:
+	static constexpr std::uint32_t kEmpty = 0;
+	static constexpr std::uint32_t kHasContinuation = 1;
+	static constexpr std::uint32_t kReady = 2;
+
+	WorkStealingPool &pool_;
+	std::atomic<std::uint32_t> refs_{1};
+	std::atomic<std::uint32_t> stage_{kEmpty};
+	Task continuation_{};
+	std::optional<Value> value_;
+};
+
+// Write side of a Future. Must be satisfied exactly once before its futures are waited on.
+template<typename T>
+class Promise {
+public:
+	explicit Promise(WorkStealingPool &pool) : state_{new FutureState<T>(pool)} {
+	}
+
+	Promise(Promise &&other) noexcept
+		: state_{std::exchange(other.state_, nullptr)},
+		  retrieved_{other.retrieved_} {
+	}
+
+	Promise &operator=(Promise &&other) noexcept {
+		if (this != &other) {
+			if (state_)
+				state_->release();
+			state_ = std::exchange(other.state_, nullptr);
+			retrieved_ = other.retrieved_;
+		}
+		return *this;
+	}
+
+	~Promise() {
+		if (state_)
+			state_->release();
+	}
+
+	// Call once.
+	[[nodiscard]]
+	Future<T> get_future() {
+		assert(state_ && !retrieved_);
+		retrieved_ = true;
+		state_->retain();
+		return Future<T>(state_);
+	}
+
+	template<typename... Args>
+	void set_value(Args &&... args) {
+		assert(state_);
+		state_->set(std::forward<Args>(args)...);
+	}
+
+private:
+	FutureState<T> *state_;
+	bool retrieved_ = false;
+};
+
+// Move-only handle to a value computed on a WorkStealingPool. then() chains a continuation that
+// runs as a pool task when the value is set; get() and wait() help run pool tasks instead of
+// blocking. Tasks, and therefore continuations, must not throw.
+template<typename T>
+class Future {
+public:
+	using Value = typename FutureState<T>::Value;
+
+	Future() = default;
+
+	explicit Future(FutureState<T> *state) noexcept : state_{state} {
+	}
+
+	Future(Future &&other) noexcept : state_{std::exchange(other.state_, nullptr)} {
+	}
+
+	Future &operator=(Future &&other) noexcept {
+		if (this != &other) {
+			reset();
+			state_ = std::exchange(other.state_, nullptr);
+		}
+		return *this;
+	}
+
+	~Future() { reset(); }
+
+	[[nodiscard]]
+	bool valid() const noexcept { return state_ != nullptr; }
+
+	[[nodiscard]]
+	bool is_ready() const noexcept { return state_ && state_->ready(); }
+
+	[[nodiscard]]
+	WorkStealingPool &pool() const noexcept { return state_->pool(); }
+
+	void wait() const {
+		assert(valid());
+		while (!state_->ready()) {
+			if (!state_->pool().run_one())
+				std::this_thread::yield();
+		}
+	}
+
+	// Wait for and move out the value; the future is invalid afterwards.
+	T get() {
+		wait();
+		auto *state = std::exchange(state_, nullptr);
+		if constexpr (std::is_void_v<T>) {
+			state->release();
+		} else {
+			auto value = state->take();
+			state->release();
+			return value;
+		}
+	}
+
+	// Future of f(value) (f() for Future<void>), run on the pool once this future is ready.
+	// Consumes this future.
+	template<typename F>
+	auto then(F &&f) {
+		using Fn = std::decay_t<F>;
+		using R = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<Fn &>,
+			std::invoke_result<Fn &, std::add_rvalue_reference_t<T> > >::type;
+		assert(valid());
+
+		struct Continuation {
+			FutureState<T> *source;
+			FutureState<R> *target;
+			Fn fn;
+
+			static void run(void *p) {
+				std::unique_ptr<Continuation> self(static_cast<Continuation *>(p));
+				if constexpr (std::is_void_v<R>) {
+					invoke_with_value(self->fn, *self->source);
+					self->target->set();
+				} else {
+					self->target->set(invoke_with_value(self->fn, *self->source));
+				}
+				self->source->release();
+				self->target->release();
+			}
+		};
+
+		auto *target = new FutureState<R>(state_->pool());
+		target->retain();
+		auto *source = std::exchange(state_, nullptr);
+		source->attach(Task{&Continuation::run, new Continuation{source, target, std::forward<F>(f)}});
+		return Future<R>(target);
+	}
+
+private:
+	template<typename Fn>
+	static decltype(auto) invoke_with_value(Fn &fn, FutureState<T> &state) {
+		if constexpr (std::is_void_v<T>)
+			return std::invoke(fn);
+		else
+			return std::invoke(fn, state.take());
+	}
+
+	void reset() noexcept {
+		if (state_)
+			std::exchange(state_, nullptr)->release();
+	}
+
+	FutureState<T> *state_ = nullptr;
+};
+
+// Run f() on pool and return a future of its result.
+template<typename F>
+auto async(WorkStealingPool &pool, F &&f) {
+	using R = std::invoke_result_t<std::decay_t<F> &>;
+	Promise<R> promise(pool);
+	auto future = promise.get_future();
+	pool.submit([promise = std::move(promise), f = std::forward<F>(f)]() mutable {
+		if constexpr (std::is_void_v<R>) {
+			f();
+			promise.set_value();
+		} else {
+			promise.set_value(f());
+		}
+	});
+	return future;
+}
+
+template<typename T, typename... Args>
+Future<T> make_ready_future(WorkStealingPool &pool, Args &&... args) {
+	Promise<T> promise(pool);
+	auto future = promise.get_future();
+	promise.set_value(std::forward<Args>(args)...);
+	return future;
+}
+
+// Future of all the values, in input order (Future<void> for void futures). Needs at least one
+// future, which supplies the pool.
+template<typename T>
+auto when_all(std::vector<Future<T> > futures) {
+	assert(!futures.empty());
+	using Result = std::conditional_t<std::is_void_v<T>, void, std::vector<T> >;
+	struct Join {
+		explicit Join(WorkStealingPool &pool, size_t n) : promise(pool), values(n), remaining{n} {
+		}
+
+		Promise<Result> promise;
+		std::vector<std::optional<typename Future<T>::Value> > values;
+		std::atomic<size_t> remaining;
+
+		void arrive() {
+			if (remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			if constexpr (std::is_void_v<T>) {
+				promise.set_value();
+			} else {
+				std::vector<T> out;
+				out.reserve(values.size());
+				for (auto &v: values)
+					out.push_back(std::move(*v));
+				promise.set_value(std::move(out));
+			}
+		}
+	};
+
+	auto join = std::make_shared<Join>(futures.front().pool(), futures.size());
+	auto result = join->promise.get_future();
+	for (size_t i = 0; i < futures.size(); ++i) {
+		if constexpr (std::is_void_v<T>) {
+			(void) futures[i].then([join] { join->arrive(); });
+		} else {
+			(void) futures[i].then([join, i](T value) {
+				join->values[i].emplace(std::move(value));
+				join->arrive();
+			});
+		}
+	}
+	return result;
+}
+
+// Future of the index and value of the first future to become ready (just the index for void
+// futures). The other values are dropped. Needs at least one future, which supplies the pool.
+template<typename T>
+auto when_any(std::vector<Future<T> > futures) {
+	assert(!futures.empty());
+	using Result = std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T> >;
+	struct Race {
+		explicit Race(WorkStealingPool &pool) : promise(pool) {
+		}
+
+		Promise<Result> promise;
+		std::atomic<bool> done{false};
+
+		[[nodiscard]]
+		bool win() { return !done.exchange(true, std::memory_order_acq_rel); }
+	};
+
+	auto race = std::make_shared<Race>(futures.front().pool());
+	auto result = race->promise.get_future();
+	for (size_t i = 0; i < futures.size(); ++i) {
+		if constexpr (std::is_void_v<T>) {
+			(void) futures[i].then([race, i] {
+				if (race->win())
+					race->promise.set_value(i);
+			});
+		} else {
+			(void) futures[i].then([race, i](T value) {
+				if (race->win())
+					race->promise.set_value(i, std::move(value));
+			});
+		}
+	}
+	return result;
+}
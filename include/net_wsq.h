@@ -0,0 +1,400 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+// TCP address of a node's steal server.
+struct NodeEndpoint {
+	std::string host = "127.0.0.1";
+	std::uint16_t port = 0;
+};
+
+// Listening socket bound to the loopback interface. port 0 picks a free port.
+struct NodeListener {
+	int fd;
+	std::uint16_t port;
+
+	[[nodiscard]]
+	static NodeListener bind_loopback(std::uint16_t port = 0) {
+		const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (fd == -1) {
+			throw std::system_error(errno, std::generic_category(), "socket");
+		}
+		const int one = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		socklen_t len = sizeof(addr);
+		if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1 ||
+		    ::listen(fd, 64) == -1 ||
+		    ::getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+			const int err = errno;
+			::close(fd);
+			throw std::system_error(err, std::generic_category(), "bind/listen");
+		}
+		return {fd, ntohs(addr.sin_port)};
+	}
+};
+
+// One node of a cluster-wide work-stealing layer. The owner thread uses queue() like any
+// WorkStealingQueue; a server thread answers steal requests from other nodes by batch-stealing
+// half of the local queue and sending the items back as raw bytes, so T must be trivially
+// copyable and have the same layout on every node.
+//
+// Termination is detected with the four-counter method: every node counts items sent to and
+// received from peers and reports whether it is idle; the computation is over once two
+// consecutive status rounds see every node idle, identical counters, and sent == received.
+//
+// A victim only counts a batch as sent once the thief acknowledges it. If the reply or the ack
+// fails, the batch is kept aside (the node reports busy meanwhile) and the owner takes it back
+// on its next steal_from(). Every connect, send and receive is bounded by a timeout, so a hung
+// peer costs a failed steal instead of blocking the node. A thief stalled for longer than the
+// victim's timeout between receiving a batch and acknowledging it can still duplicate it.
+template<typename T, size_t Capacity>
+class NetworkStealingNode {
+	static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+public:
+	static constexpr std::chrono::milliseconds kDefaultTimeout{1000};
+
+	// Takes ownership of the listening socket and starts serving steal requests. timeout bounds
+	// each network operation of this node, both as thief and as server.
+	explicit NetworkStealingNode(NodeListener listener, std::chrono::milliseconds timeout = kDefaultTimeout)
+		: listen_fd_{listener.fd},
+		  timeout_{timeout},
+		  server_{[this] { serve(); }} {
+	}
+
+	~NetworkStealingNode() {
+		// Wakes the blocked accept().
+		::shutdown(listen_fd_, SHUT_RDWR);
+		server_.join();
+		::close(listen_fd_);
+	}
+
+	NetworkStealingNode(const NetworkStealingNode &) = delete;
+	NetworkStealingNode &operator=(const NetworkStealingNode &) = delete;
+
+	[[nodiscard]]
+	WorkStealingQueue<T, Capacity> &queue() noexcept { return queue_; }
+
+	// Owner: mark whether this node holds no work (empty queue, nothing running).
+	void set_idle(bool idle) noexcept { idle_.store(idle, std::memory_order_seq_cst); }
+
+	// Owner: ask victim for half of its queue and push what arrives onto the local queue.
+	// Returns the number of items received; 0 if the victim had nothing, is unreachable or timed
+	// out. Items that an earlier reply of this node failed to deliver are taken back first and
+	// returned instead, without contacting victim.
+	size_t steal_from(const NodeEndpoint &victim) {
+		if (const auto reclaimed = reclaim_returned()) {
+			return reclaimed;
+		}
+		const int fd = connect_to(victim, timeout_);
+		if (fd == -1) {
+			return 0;
+		}
+		std::uint32_t count = 0;
+		std::vector<T> items;
+		bool ok = send_all(fd, &kStealRequest, 1) && recv_all(fd, &count, sizeof(count));
+		if (ok && count > 0) {
+			items.resize(count);
+			ok = recv_all(fd, items.data(), count * sizeof(T)) && send_all(fd, &kAck, 1);
+		}
+		close_connection(fd);
+		if (!ok || count == 0) {
+			return 0;
+		}
+		// Leave idle before counting the items, so no status snapshot sees them nowhere.
+		set_idle(false);
+		received_.fetch_add(count, std::memory_order_seq_cst);
+		for (const auto &item: items) {
+			queue_.emplace(item);
+		}
+		return count;
+	}
+
+	struct Status {
+		std::uint8_t idle;
+		std::uint64_t sent;
+		std::uint64_t received;
+
+		friend bool operator==(const Status &, const Status &) = default;
+	};
+
+	[[nodiscard]]
+	static std::optional<Status> query_status(const NodeEndpoint &node,
+	                                          std::chrono::milliseconds timeout = kDefaultTimeout) {
+		const int fd = connect_to(node, timeout);
+		if (fd == -1) {
+			return std::nullopt;
+		}
+		Status status{};
+		const bool ok = send_all(fd, &kStatusRequest, 1) && recv_all(fd, &status, sizeof(status));
+		close_connection(fd);
+		return ok ? std::optional{status} : std::nullopt;
+	}
+
+	// Global termination check over every node of the job (including this one).
+	[[nodiscard]]
+	static bool terminated(std::span<const NodeEndpoint> nodes,
+	                       std::chrono::milliseconds timeout = kDefaultTimeout) {
+		auto snapshot = [&]() -> std::optional<std::vector<Status> > {
+			std::vector<Status> round;
+			for (const auto &node: nodes) {
+				auto status = query_status(node, timeout);
+				if (!status || !status->idle) {
+					return std::nullopt;
+				}
+				round.push_back(*status);
+			}
+			return round;
+		};
+		const auto first = snapshot();
+		if (!first) {
+			return false;
+		}
+		const auto second = snapshot();
+		if (!second || *first != *second) {
+			return false;
+		}
+		std::uint64_t sent = 0, received = 0;
+		for (const auto &s: *second) {
+			sent += s.sent;
+			received += s.received;
+		}
+		return sent == received;
+	}
+
+private:
+	static constexpr char kStealRequest = 'S';
+	static constexpr char kStatusRequest = 'Q';
+	static constexpr char kAck = 'A';
+
+	void serve() {
+		while (true) {
+			const int fd = ::accept(listen_fd_, nullptr, nullptr);
+			if (fd == -1) {
+				if (errno == EINTR || errno == ECONNABORTED) {
+					continue;
+				}
+				return;
+			}
+			set_timeouts(fd, timeout_);
+			char request = 0;
+			if (recv_all(fd, &request, 1)) {
+				if (request == kStealRequest) {
+					serve_steal(fd);
+				} else if (request == kStatusRequest) {
+					// Items kept aside from a failed reply are still this node's work.
+					bool holding;
+					{
+						std::lock_guard lock(returned_mutex_);
+						holding = !returned_.empty();
+					}
+					const Status status{
+						static_cast<std::uint8_t>(idle_.load(std::memory_order_seq_cst) && !holding),
+						sent_.load(std::memory_order_seq_cst),
+						received_.load(std::memory_order_seq_cst)
+					};
+					send_all(fd, &status, sizeof(status));
+				}
+				// Let the client close first; its reset-close leaves no TIME_WAIT behind. A client
+				// that keeps the connection open is dropped after the timeout.
+				const auto deadline = std::chrono::steady_clock::now() + timeout_;
+				char eof;
+				while (std::chrono::steady_clock::now() < deadline && ::recv(fd, &eof, 1, 0) > 0) {
+				}
+			}
+			::close(fd);
+		}
+	}
+
+	// Batch steal: take about half of the queue (at least one item) one CAS at a time. The batch
+	// is only counted as sent once the thief acknowledges it; until then the status request that
+	// could observe it waits behind this one on the server thread.
+	void serve_steal(int fd) {
+		const auto target = std::max<size_t>(queue_.size() / 2, 1);
+		std::vector<T> items;
+		items.reserve(target);
+		while (items.size() < target) {
+			auto item = queue_.steal();
+			if (!item) {
+				break;
+			}
+			items.push_back(*item);
+		}
+		const auto count = static_cast<std::uint32_t>(items.size());
+		char ack = 0;
+		const bool delivered = send_all(fd, &count, sizeof(count)) &&
+		                       (count == 0 || (send_all(fd, items.data(), count * sizeof(T)) &&
+		                                       recv_all(fd, &ack, 1) && ack == kAck));
+		if (delivered) {
+			sent_.fetch_add(count, std::memory_order_seq_cst);
+		} else if (count > 0) {
+			// Only the owner may push onto queue_; it takes these back in steal_from().
+			std::lock_guard lock(returned_mutex_);
+			returned_.insert(returned_.end(), items.begin(), items.end());
+		}
+	}
+
+	// Owner: move items kept aside by serve_steal() back onto the queue.
+	size_t reclaim_returned() {
+		std::vector<T> items;
+		{
+			std::lock_guard lock(returned_mutex_);
+			if (returned_.empty()) {
+				return 0;
+			}
+			// Leave idle while still holding the lock, so no status reply sees the items nowhere.
+			set_idle(false);
+			items.swap(returned_);
+		}
+		for (const auto &item: items) {
+			queue_.emplace(item);
+		}
+		return items.size();
+	}
+
+	static void set_timeouts(int fd, std::chrono::milliseconds timeout) {
+		timeval tv{};
+		tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+		tv.tv_usec = static_cast<suseconds_t>(timeout.count() % 1000 * 1000);
+		::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+
+	// Non-blocking connect bounded by timeout; the socket is switched back to blocking I/O with
+	// send and receive timeouts.
+	static int connect_to(const NodeEndpoint &node, std::chrono::milliseconds timeout) {
+		const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd == -1) {
+			return -1;
+		}
+		const int one = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(node.port);
+		if (::inet_pton(AF_INET, node.host.c_str(), &addr.sin_addr) != 1) {
+			::close(fd);
+			return -1;
+		}
+		if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+			pollfd pfd{fd, POLLOUT, 0};
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (errno != EINPROGRESS ||
+			    ::poll(&pfd, 1, static_cast<int>(timeout.count())) != 1 ||
+			    ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0) {
+				::close(fd);
+				return -1;
+			}
+		}
+		::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+		set_timeouts(fd, timeout);
+		return fd;
+	}
+
+	// Requests are one short exchange per connection. Closing with a reset instead of a FIN keeps
+	// frequent steal and status polls from piling up TIME_WAIT sockets.
+	static void close_connection(int fd) {
+		const linger reset{1, 0};
+		::setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+		::close(fd);
+	}
+
+	static bool send_all(int fd, const void *data, size_t bytes) {
+		const auto *p = static_cast<const char *>(data);
+		while (bytes > 0) {
+			const auto n = ::send(fd, p, bytes, MSG_NOSIGNAL);
+			if (n <= 0) {
+				if (n == -1 && errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			p += n;
+			bytes -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	static bool recv_all(int fd, void *data, size_t bytes) {
+		auto *p = static_cast<char *>(data);
+		while (bytes > 0) {
+			const auto n = ::recv(fd, p, bytes, 0);
+			if (n <= 0) {
+				if (n == -1 && errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			p += n;
+			bytes -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	WorkStealingQueue<T, Capacity> queue_;
+	int listen_fd_;
+	std::chrono::milliseconds timeout_;
+
+	std::mutex returned_mutex_;
+	std::vector<T> returned_;
+
+	alignas(kCacheLineSize) std::atomic<bool> idle_{true};
+	std::atomic<std::uint64_t> sent_{0};
+	std::atomic<std::uint64_t> received_{0};
+
+	std::thread server_;
+};
@@ -0,0 +1,886 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+#include "blocked_range.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Unit of work stored in the pool's queues. Kept trivially copyable because
+// WorkStealingQueue::steal() copies the slot before winning its CAS.
+struct Task {
+	void (*fn)(void *) = nullptr;
+	void *arg = nullptr;
+
+	void operator()() const { fn(arg); }
+};
+
+static_assert(std::is_trivially_copyable_v<Task>);
+
+// Task that runs a heap-allocated copy of f and then frees it. It must run exactly once.
+template<typename F>
+	requires std::is_invocable_v<std::decay_t<F> &>
+Task make_task(F &&f) {
+	using Fn = std::decay_t<F>;
+	return Task{
+		[](void *p) {
+			std::unique_ptr<Fn> fn(static_cast<Fn *>(p));
+			(*fn)();
+		},
+		new Fn(std::forward<F>(f))
+	};
+}
+
+// Scheduler counters summed over the pool's workers. The *_ns fields only accumulate while
+// timing is enabled; idle_ns (time workers found nothing to run) is always measured and
+// includes the current stretch of workers that are idle or asleep when the stats are taken.
+// deadline_misses counts deadline tasks that a worker started after their deadline; aged counts
+// pops the owner served from the top of its own queue (see set_aging_interval).
+struct PoolStats {
+	std::uint64_t tasks_run = 0;
+	std::uint64_t emplaces = 0;
+	std::uint64_t pops = 0;
+	std::uint64_t steal_attempts = 0;
+	std::uint64_t steals = 0;
+	std::uint64_t injected = 0;
+	std::uint64_t emplace_ns = 0;
+	std::uint64_t pop_ns = 0;
+	std::uint64_t steal_ns = 0;
+	std::uint64_t idle_ns = 0;
+	std::uint64_t deadline_tasks = 0;
+	std::uint64_t deadline_misses = 0;
+	std::uint64_t aged = 0;
+
+	PoolStats &operator+=(const PoolStats &o) noexcept {
+		tasks_run += o.tasks_run;
+		emplaces += o.emplaces;
+		pops += o.pops;
+		steal_attempts += o.steal_attempts;
+		steals += o.steals;
+		injected += o.injected;
+		emplace_ns += o.emplace_ns;
+		pop_ns += o.pop_ns;
+		steal_ns += o.steal_ns;
+		idle_ns += o.idle_ns;
+		deadline_tasks += o.deadline_tasks;
+		deadline_misses += o.deadline_misses;
+		aged += o.aged;
+		return *this;
+	}
+
+	// Difference between two snapshots of the same pool.
+	friend PoolStats operator-(PoolStats a, const PoolStats &b) noexcept {
+		a.tasks_run -= b.tasks_run;
+		a.emplaces -= b.emplaces;
+		a.pops -= b.pops;
+		a.steal_attempts -= b.steal_attempts;
+		a.steals -= b.steals;
+		a.injected -= b.injected;
+		a.emplace_ns -= b.emplace_ns;
+		a.pop_ns -= b.pop_ns;
+		a.steal_ns -= b.steal_ns;
+		a.idle_ns -= b.idle_ns;
+		a.deadline_tasks -= b.deadline_tasks;
+		a.deadline_misses -= b.deadline_misses;
+		a.aged -= b.aged;
+		return a;
+	}
+};
+
+// One node of a parallel_for: keeps splitting its range, handing the upper halves to
+// scheduler->submit(), then runs body on what is left. Shared by WorkStealingPool and TaskArena.
+template<typename Scheduler, typename R, typename Body>
+struct ForTask {
+	R range;
+	const Body *body;
+	std::atomic<size_t> *pending;
+	Scheduler *scheduler;
+
+	static void run(void *p) {
+		auto *self = static_cast<ForTask *>(p);
+		// Keep the lower half and publish the upper halves for thieves.
+		while (self->range.is_divisible()) {
+			auto *upper = new ForTask{self->range.split(), self->body, self->pending, self->scheduler};
+			self->pending->fetch_add(1, std::memory_order_relaxed);
+			self->scheduler->submit(Task{&run, upper});
+		}
+		(*self->body)(std::as_const(self->range));
+		auto *pending = self->pending;
+		delete self;
+		pending->fetch_sub(1, std::memory_order_acq_rel);
+	}
+};
+
+// Extra work polled by idle pool workers once the pool's own queues are empty, e.g. a TaskArena.
+// run(arg) runs some of the source's tasks and returns whether it ran any; has_work(arg) keeps
+// workers from going to sleep while the source has tasks. Both are called on the thread that
+// would run the work, so a source with per-worker tasks can answer for worker_index() alone.
+struct WorkSource {
+	bool (*run)(void *) = nullptr;
+	bool (*has_work)(const void *) = nullptr;
+	void *arg = nullptr;
+};
+
+// Fixed set of worker threads, each owning a WorkStealingQueue<Task>. Workers pop from their own
+// queue (LIFO), then steal from the others (FIFO), then take externally submitted tasks.
+// Tasks must not throw. The pool must be idle (no outstanding tasks) when destroyed.
+class WorkStealingPool {
+public:
+	static constexpr size_t kQueueCapacity = 1 << 12;
+	using Queue = WorkStealingQueue<Task, kQueueCapacity>;
+
+	explicit WorkStealingPool(size_t num_workers = std::max(1u, std::thread::hardware_concurrency()))
+		: WorkStealingPool(std::vector<int>(std::max<size_t>(num_workers, 1), -1)) {
+	}
+
+	// One worker per entry of placement, pinned to that CPU (-1 leaves it unpinned), e.g. from
+	// CpuTopology::plan(). Pinning is best-effort: a worker that cannot be pinned runs unpinned.
+	explicit WorkStealingPool(std::span<const int> placement) {
+		const auto num_workers = std::max<size_t>(placement.size(), 1);
+		queues_.reserve(num_workers);
+		for (size_t i = 0; i < num_workers; ++i)
+			queues_.push_back(std::make_unique<Queue>());
+		counters_ = std::make_unique<WorkerCounters[]>(num_workers);
+		lanes_ = std::make_unique<DeadlineLane[]>(num_workers);
+		threads_.reserve(num_workers);
+		for (size_t i = 0; i < num_workers; ++i) {
+			const int cpu = i < placement.size() ? placement[i] : -1;
+			threads_.emplace_back([this, i, cpu] {
+				(void) pin_current_thread(cpu);
+				worker_loop(i);
+			});
+		}
+	}
+
+	~WorkStealingPool() {
+		stop_.store(true, std::memory_order_seq_cst);
+		wake_all();
+		for (auto &t: threads_)
+			t.join();
+	}
+
+	WorkStealingPool(const WorkStealingPool &) = delete;
+	WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+	[[nodiscard]]
+	size_t num_workers() const noexcept { return queues_.size(); }
+
+	// Pool and worker index of the calling thread, if it is one of this pool's workers.
+	[[nodiscard]]
+	std::optional<size_t> worker_index() const noexcept {
+		if (tls_pool_ == this)
+			return tls_index_;
+		return std::nullopt;
+	}
+
+	// Pool the calling thread works for, or nullptr outside of any pool.
+	[[nodiscard]]
+	static WorkStealingPool *current() noexcept { return tls_pool_; }
+
+	// Counters of all workers. Work done by non-worker threads helping in wait() is not counted.
+	[[nodiscard]]
+	PoolStats stats() const noexcept {
+		PoolStats total;
+		for (size_t i = 0; i < num_workers(); ++i)
+			total += counters_[i].snapshot();
+		return total;
+	}
+
+	// Time every emplace/pop/steal (two clock reads per operation) into the *_ns counters.
+	void set_timing(bool enabled) noexcept { timing_.store(enabled, std::memory_order_relaxed); }
+
+	// Number of tasks a worker takes from a victim per successful steal; the extras go onto the
+	// thief's own queue. Clamped to [1, kQueueCapacity].
+	void set_steal_batch(size_t n) noexcept {
+		steal_batch_.store(std::clamp<size_t>(n, 1, kQueueCapacity), std::memory_order_relaxed);
+	}
+
+	[[nodiscard]]
+	size_t steal_batch() const noexcept { return steal_batch_.load(std::memory_order_relaxed); }
+
+	// Every n-th time an owner takes from its own queue it takes the oldest task (the top, via
+	// steal()) instead of the newest, so tasks buried under a steady stream of newer ones still
+	// run while thieves are busy. 0, the default, keeps pure LIFO pops.
+	void set_aging_interval(size_t n) noexcept { aging_interval_.store(n, std::memory_order_relaxed); }
+
+	[[nodiscard]]
+	size_t aging_interval() const noexcept { return aging_interval_.load(std::memory_order_relaxed); }
+
+	// Approximate number of tasks queued on worker's queue.
+	[[nodiscard]]
+	size_t queue_size(size_t worker) const noexcept { return queues_[worker]->size(); }
+
+	// From a worker, push onto its own queue (running the task inline if the queue is full).
+	// From any other thread, hand the task to the shared injection queue.
+	void submit(Task task) {
+		if (const auto id = worker_index()) {
+			auto &counters = counters_[*id];
+			const auto t0 = timing_start();
+			const bool queued = queues_[*id]->try_emplace(task);
+			counters.add(counters.emplace_ns, timing_elapsed(t0));
+			if (!queued) {
+				task();
+				return;
+			}
+			counters.add(counters.emplaces, 1);
+		} else {
+			inject(task);
+			return;
+		}
+		notify();
+	}
+
+	// Hand task to the shared injection queue from any thread. Workers only take injected tasks
+	// once their own queue and steals come up empty, so from a worker this queues task behind
+	// all of the pool's local work, e.g. to yield after a long run of continuations.
+	void inject(Task task) {
+		{
+			std::lock_guard lock(injection_mutex_);
+			injection_.push_back(task);
+			injected_.fetch_add(1, std::memory_order_release);
+		}
+		notify();
+	}
+
+	// Convenience overload that heap-allocates the callable.
+	template<typename F>
+		requires (std::is_invocable_v<std::decay_t<F> &> && !std::is_same_v<std::decay_t<F>, Task>)
+	void submit(F &&f) {
+		submit(make_task(std::forward<F>(f)));
+	}
+
+	// Submit to an earliest-deadline-first lane instead of the deque: the calling worker's own
+	// lane, or a random worker's from other threads. Owners run their lane before their deque and
+	// thieves take the earliest deadline among the other lanes before stealing from deques.
+	void submit(Task task, std::chrono::steady_clock::time_point deadline) {
+		const auto id = worker_index();
+		auto &lane = lanes_[id.value_or(next_victim() % num_workers())];
+		const auto ns = deadline.time_since_epoch().count();
+		{
+			std::lock_guard lock(lane.mutex);
+			lane.heap.push_back({ns, task});
+			std::ranges::push_heap(lane.heap, std::greater{}, &DeadlineEntry::deadline);
+			lane.earliest.store(lane.heap.front().deadline, std::memory_order_relaxed);
+		}
+		deadline_pending_.fetch_add(1, std::memory_order_seq_cst);
+		notify();
+	}
+
+	template<typename F>
+		requires (std::is_invocable_v<std::decay_t<F> &> && !std::is_same_v<std::decay_t<F>, Task>)
+	void submit(F &&f, std::chrono::steady_clock::time_point deadline) {
+		submit(make_task(std::forward<F>(f)), deadline);
+	}
+
+	// Run one pending task on the calling thread. Returns false if none could be found.
+	bool run_one() {
+		if (auto task = find_task()) {
+			(*task)();
+			if (const auto id = worker_index())
+				counters_[*id].add(counters_[*id].tasks_run, 1);
+			return true;
+		}
+		return false;
+	}
+
+	// Worker only: pop up to out.size() tasks of the given kind (same fn) off the bottom of the
+	// calling worker's queue. Stops at the first task of another kind.
+	size_t pop_batch(void (*fn)(void *), std::span<Task> out) {
+		const auto id = worker_index();
+		if (!id)
+			return 0;
+		return queues_[*id]->pop_batch_if([fn](const Task &task) { return task.fn == fn; },
+		                                  out.begin(), out.size());
+	}
+
+	// Help run tasks, including those of work sources, until pending drops to zero.
+	void wait(const std::atomic<size_t> &pending) {
+		while (pending.load(std::memory_order_acquire) != 0) {
+			if (!run_one() && !run_sources())
+				std::this_thread::yield();
+		}
+	}
+
+	// Register a work source. Sources are polled in turn by idle workers.
+	void add_source(WorkSource source) {
+		{
+			std::lock_guard lock(sources_mutex_);
+			sources_.push_back(std::make_unique<SourceEntry>(source));
+			num_sources_.fetch_add(1, std::memory_order_seq_cst);
+		}
+		notify();
+	}
+
+	// Unregister the source with this arg. Returns once no worker is running it any more.
+	void remove_source(const void *arg) {
+		std::unique_ptr<SourceEntry> entry;
+		{
+			std::lock_guard lock(sources_mutex_);
+			const auto it = std::ranges::find(sources_, arg, [](const auto &e) { return e->source.arg; });
+			if (it == sources_.end())
+				return;
+			entry = std::move(*it);
+			sources_.erase(it);
+			num_sources_.fetch_sub(1, std::memory_order_seq_cst);
+		}
+		while (entry->users.load(std::memory_order_acquire) != 0)
+			std::this_thread::yield();
+	}
+
+	// Wake sleeping workers, e.g. after a work source received tasks.
+	void notify() {
+		epoch_.fetch_add(1, std::memory_order_seq_cst);
+		if (sleepers_.load(std::memory_order_seq_cst) != 0)
+			epoch_.notify_all();
+	}
+
+	// Recursively split range across the workers and call body(subrange) on each leaf.
+	// Blocks, helping with the work, until every leaf has run.
+	template<SplittableRange R, typename Body>
+		requires std::is_invocable_v<const Body &, const R &>
+	void parallel_for(const R &range, const Body &body) {
+		std::atomic<size_t> pending{1};
+		using Node = ForTask<WorkStealingPool, R, Body>;
+		submit(Task{&Node::run, new Node{range, &body, &pending, this}});
+		wait(pending);
+	}
+
+	// Call f(i) for every i in [begin, end), in chunks of at least grain indices.
+	template<typename F>
+		requires std::is_invocable_v<const F &, size_t>
+	void parallel_for(size_t begin, size_t end, size_t grain, const F &f) {
+		parallel_for(BlockedRange(begin, end, grain), [&f](const BlockedRange &r) {
+			for (auto i = r.begin(); i != r.end(); ++i)
+				f(i);
+		});
+	}
+
+	// Call f(i) for every index of data. Chunk boundaries fall on cache lines of data, so workers
+	// writing data[i] from adjacent chunks never false-share; grain is rounded up to a whole line.
+	template<typename T, typename F>
+		requires std::is_invocable_v<const F &, size_t>
+	void parallel_for(std::span<T> data, size_t grain, const F &f) {
+		// Iterate in line-relative coordinates so split points align to the actual addresses.
+		const auto offset = cache_line_offset(data.data());
+		parallel_for(BlockedRange(offset, offset + data.size(), grain, cache_line_elements<T>()),
+		             [&f, offset](const BlockedRange &r) {
+			             for (auto i = r.begin(); i != r.end(); ++i)
+				             f(i - offset);
+		             });
+	}
+
+	// Reduce range: every leaf computes body(leaf, identity) and partial results are combined
+	// with join. Leaves are folded into a per-worker partial in whatever order the workers reach
+	// them, and the partials are joined in worker order, so join must be commutative as well as
+	// associative: a join that depends on operand order (concatenation, matrix product) gets its
+	// leaves shuffled. Use parallel_deterministic_reduce for those. A join that is only
+	// approximately associative (floating-point addition) can differ from run to run.
+	template<typename T, SplittableRange R, typename Body, typename Join>
+		requires std::is_invocable_r_v<T, const Body &, const R &, T> &&
+		         std::is_invocable_r_v<T, const Join &, T, T>
+	T parallel_reduce(const R &range, const T &identity, const Body &body, const Join &join) {
+		// One partial per worker plus one, under a lock, for non-worker threads that help.
+		struct alignas(kCacheLineSize) Partial {
+			std::optional<T> value;
+		};
+		std::vector<Partial> partials(num_workers() + 1);
+		std::mutex external_mutex;
+		parallel_for(range, [&](const R &leaf) {
+			auto value = body(leaf, identity);
+			const auto id = worker_index();
+			std::unique_lock lock(external_mutex, std::defer_lock);
+			if (!id)
+				lock.lock();
+			auto &partial = partials[id.value_or(num_workers())].value;
+			partial = partial ? join(std::move(*partial), std::move(value)) : std::move(value);
+		});
+		T result = identity;
+		for (auto &p: partials) {
+			if (p.value)
+				result = join(std::move(result), std::move(*p.value));
+		}
+		return result;
+	}
+
+	// Like parallel_reduce, but the result is the same on every run: range is split into a binary
+	// tree that depends only on its size and grain, and each join combines the two halves of a
+	// split in order, whichever workers ran them. Subtrees are still spread through the deques.
+	template<typename T, SplittableRange R, typename Body, typename Join>
+		requires std::is_invocable_r_v<T, const Body &, const R &, T> &&
+		         std::is_invocable_r_v<T, const Join &, T, T>
+	T parallel_deterministic_reduce(const R &range, const T &identity, const Body &body, const Join &join) {
+		using Node = ReduceTask<R, T, Body, Join>;
+		std::atomic<size_t> pending{1};
+		typename Node::Context ctx{identity, &body, &join, this, &pending, {}};
+		typename Node::JoinPoint root{nullptr, 0, {}, 1};
+		submit(Task{&Node::run, new Node{range, &root, 0, &ctx}});
+		wait(pending);
+		return std::move(*ctx.result);
+	}
+
+private:
+	template<typename R, typename T, typename Body, typename Join>
+	struct ReduceTask {
+		struct Context {
+			const T &identity;
+			const Body *body;
+			const Join *join;
+			WorkStealingPool *pool;
+			std::atomic<size_t> *pending;
+			std::optional<T> result;
+		};
+
+		// Where the two halves of one split meet; the second half to finish joins them.
+		struct JoinPoint {
+			JoinPoint *parent;
+			int side;
+			std::array<std::optional<T>, 2> halves;
+			std::atomic<int> remaining;
+		};
+
+		R range;
+		JoinPoint *parent;
+		int side;
+		Context *ctx;
+
+		static void run(void *p) {
+			std::unique_ptr<ReduceTask> self(static_cast<ReduceTask *>(p));
+			auto *ctx = self->ctx;
+			// Keep the lower half, publishing each upper half behind a new join point.
+			while (self->range.is_divisible()) {
+				auto *point = new JoinPoint{self->parent, self->side, {}, 2};
+				auto upper = self->range.split();
+				self->parent = point;
+				self->side = 0;
+				ctx->pool->submit(Task{&run, new ReduceTask{std::move(upper), point, 1, ctx}});
+			}
+			deliver(*ctx, self->parent, self->side, (*ctx->body)(std::as_const(self->range), ctx->identity));
+		}
+
+		static void deliver(Context &ctx, JoinPoint *point, int side, T value) {
+			while (true) {
+				point->halves[side] = std::move(value);
+				if (point->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+					return;
+				if (!point->parent) {
+					// The root point only has the one half.
+					ctx.result = std::move(point->halves[0]);
+					ctx.pending->fetch_sub(1, std::memory_order_acq_rel);
+					return;
+				}
+				value = (*ctx.join)(std::move(*point->halves[0]), std::move(*point->halves[1]));
+				side = point->side;
+				delete std::exchange(point, point->parent);
+			}
+		}
+	};
+
+	std::optional<Task> find_task() {
+		const auto id = worker_index();
+		WorkerCounters *counters = id ? &counters_[*id] : nullptr;
+		if (deadline_pending_.load(std::memory_order_relaxed) != 0) {
+			if (auto task = take_deadline(id, counters))
+				return task;
+		}
+		if (counters) {
+			if (const auto interval = aging_interval(); interval != 0 && ++counters->pops_since_aging >= interval) {
+				counters->pops_since_aging = 0;
+				if (auto task = queues_[*id]->steal()) {
+					counters->add(counters->aged, 1);
+					return task;
+				}
+			}
+			const auto t0 = timing_start();
+			auto task = queues_[*id]->pop();
+			counters->add(counters->pop_ns, timing_elapsed(t0));
+			if (task) {
+				counters->add(counters->pops, 1);
+				return task;
+			}
+		}
+		// Start at a different victim each time to spread thieves over the queues.
+		const auto n = queues_.size();
+		const auto start = next_victim();
+		for (size_t k = 0; k < n; ++k) {
+			const auto victim = (start + k) % n;
+			if (id && victim == *id)
+				continue;
+			const auto t0 = timing_start();
+			auto task = queues_[victim]->steal();
+			if (counters) {
+				counters->add(counters->steal_ns, timing_elapsed(t0));
+				counters->add(counters->steal_attempts, 1);
+			}
+			if (task) {
+				if (counters) {
+					counters->add(counters->steals, 1);
+					steal_extra(*id, victim);
+				}
+				return task;
+			}
+		}
+		auto task = take_injected();
+		if (task && counters)
+			counters->add(counters->injected, 1);
+		return task;
+	}
+
+	// Move up to steal_batch() - 1 more tasks from victim onto thief's queue, which is empty
+	// because its pop() just failed, so the emplaces cannot block.
+	void steal_extra(size_t thief, size_t victim) {
+		const auto batch = steal_batch();
+		for (size_t k = 1; k < batch; ++k) {
+			auto task = queues_[victim]->steal();
+			if (!task)
+				break;
+			queues_[thief]->emplace(*task);
+		}
+	}
+
+	using Clock = std::chrono::steady_clock;
+
+	[[nodiscard]]
+	std::optional<Clock::time_point> timing_start() const noexcept {
+		if (!timing_.load(std::memory_order_relaxed))
+			return std::nullopt;
+		return Clock::now();
+	}
+
+	[[nodiscard]]
+	static std::uint64_t timing_elapsed(std::optional<Clock::time_point> t0) noexcept {
+		if (!t0)
+			return 0;
+		return static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - *t0).count());
+	}
+
+	// Per-worker counters, written only by their worker and read by stats().
+	struct alignas(kCacheLineSize) WorkerCounters {
+		std::atomic<std::uint64_t> tasks_run{0};
+		std::atomic<std::uint64_t> emplaces{0};
+		std::atomic<std::uint64_t> pops{0};
+		std::atomic<std::uint64_t> steal_attempts{0};
+		std::atomic<std::uint64_t> steals{0};
+		std::atomic<std::uint64_t> injected{0};
+		std::atomic<std::uint64_t> emplace_ns{0};
+		std::atomic<std::uint64_t> pop_ns{0};
+		std::atomic<std::uint64_t> steal_ns{0};
+		std::atomic<std::uint64_t> idle_ns{0};
+		std::atomic<std::uint64_t> deadline_tasks{0};
+		std::atomic<std::uint64_t> deadline_misses{0};
+		std::atomic<std::uint64_t> aged{0};
+		// Start of the current idle stretch (0 while busy). idle_seq is odd while the worker
+		// updates idle_since_ns and idle_ns together, so snapshot() reads them as a pair.
+		std::atomic<Clock::rep> idle_since_ns{0};
+		std::atomic<std::uint64_t> idle_seq{0};
+		// Owner-only: pops since the owner last took from the top of its queue.
+		size_t pops_since_aging = 0;
+
+		// Single writer: a plain load/store avoids a locked RMW on the hot path.
+		static void add(std::atomic<std::uint64_t> &counter, std::uint64_t n) noexcept {
+			if (n != 0)
+				counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		void begin_idle() noexcept {
+			idle_seq.fetch_add(1, std::memory_order_seq_cst);
+			idle_since_ns.store(now_ns(), std::memory_order_seq_cst);
+			idle_seq.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		void end_idle() noexcept {
+			idle_seq.fetch_add(1, std::memory_order_seq_cst);
+			// Read the clock inside the write section, so no snapshot that saw this stretch as
+			// still open used a later time than the one credited here.
+			const auto span = static_cast<std::uint64_t>(now_ns() - idle_since_ns.load(std::memory_order_relaxed));
+			idle_ns.store(idle_ns.load(std::memory_order_relaxed) + span, std::memory_order_seq_cst);
+			idle_since_ns.store(0, std::memory_order_seq_cst);
+			idle_seq.fetch_add(1, std::memory_order_seq_cst);
+		}
+
+		[[nodiscard]]
+		static Clock::rep now_ns() noexcept {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+		}
+
+		[[nodiscard]]
+		PoolStats snapshot() const noexcept {
+			PoolStats s{
+				tasks_run.load(std::memory_order_relaxed), emplaces.load(std::memory_order_relaxed),
+				pops.load(std::memory_order_relaxed), steal_attempts.load(std::memory_order_relaxed),
+				steals.load(std::memory_order_relaxed), injected.load(std::memory_order_relaxed),
+				emplace_ns.load(std::memory_order_relaxed), pop_ns.load(std::memory_order_relaxed),
+				steal_ns.load(std::memory_order_relaxed), 0,
+				deadline_tasks.load(std::memory_order_relaxed), deadline_misses.load(std::memory_order_relaxed),
+				aged.load(std::memory_order_relaxed)
+			};
+			// Credit an idle stretch still in progress, so a worker that stays asleep does not
+			// drop out of the idle time until it wakes up.
+			while (true) {
+				const auto seq = idle_seq.load(std::memory_order_seq_cst);
+				if (seq % 2 != 0) {
+					std::this_thread::yield();
+					continue;
+				}
+				auto idle = idle_ns.load(std::memory_order_seq_cst);
+				const auto since = idle_since_ns.load(std::memory_order_seq_cst);
+				if (since != 0)
+					idle += static_cast<std::uint64_t>(std::max<Clock::rep>(now_ns() - since, 0));
+				if (idle_seq.load(std::memory_order_seq_cst) == seq) {
+					s.idle_ns = idle;
+					return s;
+				}
+			}
+		}
+	};
+
+	// Pop the caller's own lane if it has work, else the lane with the earliest deadline.
+	std::optional<Task> take_deadline(std::optional<size_t> id, WorkerCounters *counters) {
+		std::optional<size_t> best;
+		if (id && lanes_[*id].earliest.load(std::memory_order_relaxed) != kNoDeadline) {
+			best = *id;
+		} else {
+			auto earliest = kNoDeadline;
+			for (size_t i = 0; i < num_workers(); ++i) {
+				const auto d = lanes_[i].earliest.load(std::memory_order_relaxed);
+				if (d < earliest) {
+					earliest = d;
+					best = i;
+				}
+			}
+		}
+		if (!best)
+			return std::nullopt;
+		auto &lane = lanes_[*best];
+		DeadlineEntry entry;
+		{
+			std::lock_guard lock(lane.mutex);
+			if (lane.heap.empty())
+				return std::nullopt;
+			std::ranges::pop_heap(lane.heap, std::greater{}, &DeadlineEntry::deadline);
+			entry = lane.heap.back();
+			lane.heap.pop_back();
+			lane.earliest.store(lane.heap.empty() ? kNoDeadline : lane.heap.front().deadline,
+			                    std::memory_order_relaxed);
+		}
+		deadline_pending_.fetch_sub(1, std::memory_order_relaxed);
+		if (counters) {
+			counters->add(counters->deadline_tasks, 1);
+			if (Clock::now().time_since_epoch().count() > entry.deadline)
+				counters->add(counters->deadline_misses, 1);
+		}
+		return entry.task;
+	}
+
+	std::optional<Task> take_injected() {
+		if (injected_.load(std::memory_order_acquire) == 0)
+			return std::nullopt;
+		std::lock_guard lock(injection_mutex_);
+		if (injection_.empty())
+			return std::nullopt;
+		const auto task = injection_.front();
+		injection_.pop_front();
+		injected_.fetch_sub(1, std::memory_order_relaxed);
+		return task;
+	}
+
+	static size_t next_victim() noexcept {
+		// xorshift64, seeded per thread.
+		thread_local std::uint64_t state =
+				std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1;
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return static_cast<size_t>(state);
+	}
+
+	void worker_loop(size_t id) {
+		tls_pool_ = this;
+		tls_index_ = id;
+		auto &counters = counters_[id];
+		size_t idle_rounds = 0;
+		bool idle = false;
+		while (!stop_.load(std::memory_order_relaxed)) {
+			if (run_one() || run_sources()) {
+				if (idle) {
+					counters.end_idle();
+					idle = false;
+				}
+				idle_rounds = 0;
+			} else if (!idle) {
+				idle = true;
+				counters.begin_idle();
+			} else if (++idle_rounds < kSpinRounds) {
+				std::this_thread::yield();
+			} else {
+				sleep();
+				idle_rounds = 0;
+			}
+		}
+		tls_pool_ = nullptr;
+	}
+
+	// Block until a submit() or shutdown after a final check for work. The epoch is read before
+	// the check, so a submission racing with it makes wait() return immediately.
+	void sleep() {
+		sleepers_.fetch_add(1, std::memory_order_seq_cst);
+		const auto epoch = epoch_.load(std::memory_order_seq_cst);
+		if (!stop_.load(std::memory_order_seq_cst) && !has_visible_work())
+			epoch_.wait(epoch, std::memory_order_seq_cst);
+		sleepers_.fetch_sub(1, std::memory_order_seq_cst);
+	}
+
+	[[nodiscard]]
+	bool has_visible_work() {
+		if (injected_.load(std::memory_order_seq_cst) != 0 || deadline_pending_.load(std::memory_order_seq_cst) != 0)
+			return true;
+		if (std::ranges::any_of(queues_, [](const auto &q) { return !q->empty(); }))
+			return true;
+		if (num_sources_.load(std::memory_order_seq_cst) == 0)
+			return false;
+		std::lock_guard lock(sources_mutex_);
+		return std::ranges::any_of(sources_, [](const auto &e) { return e->source.has_work(e->source.arg); });
+	}
+
+	// Run work from the first source, starting at a rotating position, that has any.
+	bool run_sources() {
+		if (num_sources_.load(std::memory_order_relaxed) == 0)
+			return false;
+		SourceEntry *entry = nullptr;
+		{
+			std::lock_guard lock(sources_mutex_);
+			const auto n = sources_.size();
+			const auto start = next_victim();
+			for (size_t k = 0; k < n && !entry; ++k) {
+				auto &e = sources_[(start + k) % n];
+				if (e->source.has_work(e->source.arg))
+					entry = e.get();
+			}
+			if (!entry)
+				return false;
+			// Taken under the lock, so remove_source() waits for this run.
+			entry->users.fetch_add(1, std::memory_order_relaxed);
+		}
+		const bool ran = entry->source.run(entry->source.arg);
+		entry->users.fetch_sub(1, std::memory_order_release);
+		return ran;
+	}
+
+	void wake_all() {
+		epoch_.fetch_add(1, std::memory_order_seq_cst);
+		epoch_.notify_all();
+	}
+
+	static constexpr size_t kSpinRounds = 64;
+
+	static inline thread_local WorkStealingPool *tls_pool_ = nullptr;
+	static inline thread_local size_t tls_index_ = 0;
+
+	std::vector<std::unique_ptr<Queue> > queues_;
+	std::unique_ptr<WorkerCounters[]> counters_;
+	std::vector<std::thread> threads_;
+
+	struct SourceEntry {
+		explicit SourceEntry(WorkSource s) : source{s} {
+		}
+
+		WorkSource source;
+		std::atomic<size_t> users{0};
+	};
+
+	std::mutex sources_mutex_;
+	std::vector<std::unique_ptr<SourceEntry> > sources_;
+	std::atomic<size_t> num_sources_{0};
+
+	struct DeadlineEntry {
+		Clock::rep deadline;
+		Task task;
+	};
+
+	static constexpr Clock::rep kNoDeadline = std::numeric_limits<Clock::rep>::max();
+
+	// Small min-heap on deadline; earliest mirrors its front so thieves can pick a lane unlocked.
+	struct alignas(kCacheLineSize) DeadlineLane {
+		std::mutex mutex;
+		std::vector<DeadlineEntry> heap;
+		std::atomic<Clock::rep> earliest{kNoDeadline};
+	};
+
+	std::unique_ptr<DeadlineLane[]> lanes_;
+	alignas(kCacheLineSize) std::atomic<size_t> deadline_pending_{0};
+
+	std::mutex injection_mutex_;
+	std::deque<Task> injection_;
+
+	alignas(kCacheLineSize) std::atomic<size_t> injected_{0};
+	std::atomic<size_t> steal_batch_{1};
+	std::atomic<size_t> aging_interval_{0};
+	alignas(kCacheLineSize) std::atomic<std::uint32_t> epoch_{0};
+	alignas(kCacheLineSize) std::atomic<size_t> sleepers_{0};
+	alignas(kCacheLineSize) std::atomic<bool> stop_{false};
+	std::atomic<bool> timing_{false};
+};
+
+// Tasks of one kind that run together: when a worker dequeues one, it also pops the same-kind
+// tasks queued directly below it (up to MaxBatch in total) and calls Kernel once on all their
+// args, e.g. to score a batch of items with a vectorized loop instead of one call per item.
+template<typename Arg, auto Kernel, size_t MaxBatch = 64>
+	requires std::is_invocable_v<decltype(Kernel), std::span<Arg *const>>
+struct BatchTask {
+	static_assert(MaxBatch > 0);
+
+	[[nodiscard]]
+	static Task make(Arg *arg) noexcept { return Task{&run, arg}; }
+
+	static void run(void *first) {
+		std::array<Task, MaxBatch> tasks;
+		tasks[0] = Task{&run, first};
+		size_t n = 1;
+		if (auto *pool = WorkStealingPool::current())
+			n += pool->pop_batch(&run, std::span(tasks).subspan(1));
+		std::array<Arg *, MaxBatch> batch;
+		for (size_t i = 0; i < n; ++i)
+			batch[i] = static_cast<Arg *>(tasks[i].arg);
+		Kernel(std::span<Arg *const>(batch.data(), n));
+	}
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+
+
+// Half-open index range [begin, end) held in one slot of a RangeWorkStealingQueue.
+struct IndexRange {
+	std::uint32_t begin;
+	std::uint32_t end;
+
+	[[nodiscard]]
+	std::uint32_t size() const noexcept { return end > begin ? end - begin : 0; }
+
+	[[nodiscard]]
+	bool empty() const noexcept { return end <= begin; }
+
+	friend bool operator==(const IndexRange &, const IndexRange &) = default;
+};
+
+// Chase–Lev style deque whose slots are index ranges rather than tasks. A whole loop occupies
+// a single slot: the owner consumes grain-sized chunks from the lower end of its newest range
+// while thieves split the oldest range in half and take the upper part. Both sides claim
+// indices with a CAS on the slot word itself, so a range is never handed out twice, and
+// top_/bottom_ only retire slots that have already been drained.
+template<size_t Capacity>
+class RangeWorkStealingQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0,
+	              "Capacity must be power of two");
+	static_assert(Capacity > 0, "Capacity must be positive");
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+public:
+	static constexpr std::uint32_t kWholeRange = std::numeric_limits<std::uint32_t>::max();
+
+	RangeWorkStealingQueue()
+		: buffer_{std::make_unique<std::atomic<std::uint64_t>[]>(Capacity)} {
+	}
+
+	RangeWorkStealingQueue(const RangeWorkStealingQueue &) = delete;
+	RangeWorkStealingQueue &operator=(const RangeWorkStealingQueue &) = delete;
+
+	[[nodiscard]]
+	size_t capacity() const noexcept { return Capacity; }
+
+	// Number of occupied slots, including drained ones that have not been retired yet.
+	[[nodiscard]]
+	size_t size() const noexcept {
+		const auto bottom = bottom_.load(std::memory_order_acquire);
+		const auto top = top_.load(std::memory_order_acquire);
+		return bottom >= top ? static_cast<size_t>(bottom - top) : 0;
+	}
+
+	[[nodiscard]]
+	bool empty() const noexcept { return size() == 0; }
+
+	void push(IndexRange range) noexcept {
+		do {
+		} while (!try_push(range));
+	}
+
+	[[nodiscard]]
+	bool try_push(IndexRange range) noexcept {
+		if (range.empty()) {
+			return true;
+		}
+		const auto write_idx = bottom_.load(std::memory_order_relaxed);
+		const auto top = top_.load(std::memory_order_acquire);
+		if (write_idx - top >= static_cast<long long>(Capacity)) {
+			return false;
+		}
+		buffer_[write_idx & kMask].store(pack(range), std::memory_order_relaxed);
+		bottom_.store(write_idx + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Owner: claim up to grain indices from the lower end of the newest range.
+	[[nodiscard]]
+	std::optional<IndexRange> pop(std::uint32_t grain = kWholeRange) noexcept {
+		assert(grain > 0);
+		while (true) {
+			const auto bottom = bottom_.load(std::memory_order_relaxed);
+			if (bottom <= top_.load(std::memory_order_acquire)) {
+				return std::nullopt;
+			}
+			auto &slot = buffer_[(bottom - 1) & kMask];
+			auto word = slot.load(std::memory_order_acquire);
+			while (!unpack(word).empty()) {
+				const auto range = unpack(word);
+				const auto split = range.size() > grain ? range.begin + grain : range.end;
+				if (slot.compare_exchange_weak(word, pack({split, range.end}),
+				                               std::memory_order_acq_rel,
+				                               std::memory_order_acquire)) {
+					return IndexRange{range.begin, split};
+				}
+			}
+			retire_bottom();
+		}
+	}
+
+	// Thief: split the oldest range and take its upper half (all of it if it holds one index).
+	[[nodiscard]]
+	std::optional<IndexRange> steal() noexcept {
+		while (true) {
+			auto steal_idx = top_.load(std::memory_order_acquire);
+			const auto bottom = bottom_.load(std::memory_order_acquire);
+			if (steal_idx >= bottom) {
+				return std::nullopt;
+			}
+			auto &slot = buffer_[steal_idx & kMask];
+			auto word = slot.load(std::memory_order_acquire);
+			const auto range = unpack(word);
+			if (range.empty()) {
+				// Drained by the owner but not retired yet: help advance top_ and look again.
+				top_.compare_exchange_strong(steal_idx, steal_idx + 1, std::memory_order_seq_cst,
+				                             std::memory_order_relaxed);
+				continue;
+			}
+			const auto mid = range.begin + range.size() / 2;
+			if (slot.compare_exchange_strong(word, pack({range.begin, mid}),
+			                                 std::memory_order_acq_rel,
+			                                 std::memory_order_relaxed)) {
+				return IndexRange{mid, range.end};
+			}
+			// Thief loses the race for the slot: cancel steal.
+			return std::nullopt;
+		}
+	}
+
+private:
+	static constexpr size_t kMask = Capacity - 1;
+
+	static constexpr std::uint64_t pack(IndexRange range) noexcept {
+		return static_cast<std::uint64_t>(range.begin) << 32 | range.end;
+	}
+
+	static constexpr IndexRange unpack(std::uint64_t word) noexcept {
+		return {static_cast<std::uint32_t>(word >> 32), static_cast<std::uint32_t>(word)};
+	}
+
+	// Drop the drained bottom slot. Same protocol as WorkStealingQueue::pop(), minus the element.
+	void retire_bottom() noexcept {
+		const auto pop_idx = bottom_.load(std::memory_order_relaxed) - 1;
+		bottom_.store(pop_idx, std::memory_order_seq_cst);
+		auto top = top_.load(std::memory_order_seq_cst);
+		if (pop_idx < top) {
+			bottom_.store(pop_idx + 1, std::memory_order_relaxed);
+		} else if (pop_idx == top) {
+			// Either we or a helping thief advance top_ past the slot; both leave the deque empty.
+			top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+			                             std::memory_order_relaxed);
+			bottom_.store(pop_idx + 1, std::memory_order_relaxed);
+		}
+	}
+
+	std::unique_ptr<std::atomic<std::uint64_t>[]> buffer_;
+
+	// Isolate heavily accessed resources.
+	alignas(kCacheLineSize) std::atomic<long long> top_{0};
+	alignas(kCacheLineSize) std::atomic<long long> bottom_{0};
+
+	// Tail guard to ensure there isn't false sharing with the next element in memory.
+	alignas(kCacheLineSize) std::byte tail_guard_[kCacheLineSize]{};
+};
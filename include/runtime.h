@@ -0,0 +1,91 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+#include "task_arena.h"
+#include "topology.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+
+// One WorkStealingPool per process, built on first use and shared by every component that asks
+// for it, so components don't each spawn threads and allocate queue rings at startup or
+// oversubscribe the cores. Workers are placed with CpuTopology (one per allowed CPU unless
+// configured). Components that need isolation or a concurrency cap take a view: a TaskArena on
+// the shared pool. Views must be destroyed before static destruction tears the pool down.
+class Runtime {
+public:
+	Runtime() = delete;
+
+	// Worker count (0: one per allowed CPU) and placement for the pool. Only effective before
+	// the first pool() or view() call; returns false once the pool is running.
+	static bool configure(size_t num_workers, Placement placement = Placement::Scatter) {
+		std::lock_guard lock(state().mutex);
+		if (state().started.load(std::memory_order_relaxed))
+			return false;
+		state().num_workers = num_workers;
+		state().placement = placement;
+		return true;
+	}
+
+	[[nodiscard]]
+	static bool started() noexcept { return state().started.load(std::memory_order_acquire); }
+
+	// The shared pool, started on the first call.
+	static WorkStealingPool &pool() {
+		static WorkStealingPool pool{[] {
+			std::lock_guard lock(state().mutex);
+			const auto topology = CpuTopology::discover();
+			const auto n = state().num_workers != 0 ? state().num_workers : std::max<size_t>(topology.num_cpus(), 1);
+			auto plan = topology.plan(n, state().placement);
+			state().started.store(true, std::memory_order_release);
+			return plan;
+		}()};
+		return pool;
+	}
+
+	// An arena on the shared pool, run by at most max_concurrency threads (0: all workers).
+	[[nodiscard]]
+	static std::unique_ptr<TaskArena> view(size_t max_concurrency = 0) {
+		auto &shared = pool();
+		return std::make_unique<TaskArena>(shared, max_concurrency != 0 ? max_concurrency : shared.num_workers());
+	}
+
+private:
+	struct State {
+		std::mutex mutex;
+		std::atomic<bool> started{false};
+		size_t num_workers = 0;
+		Placement placement = Placement::Scatter;
+	};
+
+	static State &state() {
+		static State s;
+		return s;
+	}
+};
@@ -0,0 +1,282 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// What happened to a task: the thread that spawned it, or that ran it (Stolen if a worker other
+// than the spawning one ran it). worker is -1 for threads outside the pool.
+enum class ScheduleEventKind : std::uint8_t { Spawn, Run, Stolen };
+
+struct ScheduleEvent {
+	std::uint64_t time_ns;
+	std::uint64_t task;
+	std::int32_t worker;
+	ScheduleEventKind kind;
+};
+
+// Recorded schedule. Text format: one "time_ns task worker kind" line per event, kind being
+// 0 (spawn), 1 (run) or 2 (stolen).
+struct ScheduleLog {
+	std::vector<ScheduleEvent> events;
+
+	// Worker that ran each task.
+	[[nodiscard]]
+	std::unordered_map<std::uint64_t, std::int32_t> assignment() const {
+		std::unordered_map<std::uint64_t, std::int32_t> workers;
+		for (const auto &e: events) {
+			if (e.kind != ScheduleEventKind::Spawn)
+				workers[e.task] = e.worker;
+		}
+		return workers;
+	}
+
+	void save(std::ostream &out) const {
+		for (const auto &e: events) {
+			out << e.time_ns << ' ' << e.task << ' ' << e.worker << ' ' << static_cast<int>(e.kind) << '\n';
+		}
+	}
+
+	[[nodiscard]]
+	static ScheduleLog load(std::istream &in) {
+		ScheduleLog log;
+		ScheduleEvent e{};
+		int kind = 0;
+		while (in >> e.time_ns >> e.task >> e.worker >> kind) {
+			e.kind = static_cast<ScheduleEventKind>(kind);
+			log.events.push_back(e);
+		}
+		return log;
+	}
+};
+
+// Names tasks by their place in the spawn tree (parent id, spawn ordinal), so that the same
+// program spawns the same ids on every run however the tasks are scheduled. Roots are numbered
+// in spawn order, so spawn them from one thread.
+class TaskNaming {
+public:
+	TaskNaming() = default;
+
+	TaskNaming(const TaskNaming &) = delete;
+	TaskNaming &operator=(const TaskNaming &) = delete;
+
+	// Id for a task spawned by the calling thread now.
+	[[nodiscard]]
+	std::uint64_t next_id() noexcept {
+		if (current_.naming == this)
+			return mix(current_.id, ++current_.children);
+		return mix(0, roots_.fetch_add(1, std::memory_order_relaxed) + 1);
+	}
+
+	// Run f as task id, so tasks it spawns are named after it.
+	template<typename F>
+	void run_as(std::uint64_t id, F &f) {
+		const auto outer = std::exchange(current_, Current{this, id, 0});
+		f();
+		current_ = outer;
+	}
+
+private:
+	struct Current {
+		const TaskNaming *naming;
+		std::uint64_t id;
+		std::uint64_t children;
+	};
+
+	// splitmix64 finalizer over (parent, ordinal).
+	static std::uint64_t mix(std::uint64_t parent, std::uint64_t ordinal) noexcept {
+		auto x = parent * 0x9E3779B97F4A7C15ull + ordinal;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	static inline thread_local Current current_{nullptr, 0, 0};
+
+	std::atomic<std::uint64_t> roots_{0};
+};
+
+// Logs which worker spawned and ran each task spawned through it. Every thread appends to its
+// own log (a mutex only guards the one shared by non-worker threads), so recording costs one
+// clock read and one vector append per event.
+class ScheduleRecorder {
+public:
+	explicit ScheduleRecorder(WorkStealingPool &pool)
+		: pool_{pool}, logs_(pool.num_workers() + 1) {
+	}
+
+	template<typename F>
+	void spawn(F &&f) {
+		const auto id = naming_.next_id();
+		const auto spawner = worker();
+		append(spawner, ScheduleEventKind::Spawn, id);
+		pool_.submit([this, id, spawner, f = std::forward<F>(f)]() mutable {
+			const auto runner = worker();
+			append(runner, runner == spawner ? ScheduleEventKind::Run : ScheduleEventKind::Stolen, id);
+			naming_.run_as(id, f);
+		});
+	}
+
+	// Merge the per-thread logs in time order. Call once every recorded task has finished.
+	[[nodiscard]]
+	ScheduleLog take() {
+		ScheduleLog log;
+		for (auto &l: logs_) {
+			log.events.insert(log.events.end(), l.events.begin(), l.events.end());
+			l.events.clear();
+		}
+		std::ranges::stable_sort(log.events, {}, &ScheduleEvent::time_ns);
+		return log;
+	}
+
+private:
+	struct alignas(kCacheLineSize) ThreadLog {
+		std::vector<ScheduleEvent> events;
+	};
+
+	[[nodiscard]]
+	std::int32_t worker() const noexcept {
+		const auto id = pool_.worker_index();
+		return id ? static_cast<std::int32_t>(*id) : -1;
+	}
+
+	void append(std::int32_t worker, ScheduleEventKind kind, std::uint64_t id) {
+		const ScheduleEvent event{
+			static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count()),
+			id, worker, kind
+		};
+		if (worker >= 0) {
+			logs_[static_cast<size_t>(worker)].events.push_back(event);
+		} else {
+			std::lock_guard lock(external_mutex_);
+			logs_.back().events.push_back(event);
+		}
+	}
+
+	WorkStealingPool &pool_;
+	TaskNaming naming_;
+	std::vector<ThreadLog> logs_;
+	std::mutex external_mutex_;
+};
+
+// Replays the task-to-worker assignment of a ScheduleLog: a task spawned through it is handed to
+// the mailbox of the worker that ran it in the recording, which only that worker drains.
+// Mailboxes are a WorkSource of the pool, so wait() on a worker keeps draining its own. Tasks
+// the log doesn't know are submitted to the pool as usual and counted in unmatched().
+// The program must spawn the same tree as when it was recorded.
+class ScheduleReplayer {
+public:
+	ScheduleReplayer(WorkStealingPool &pool, const ScheduleLog &log)
+		: pool_{pool},
+		  assignment_{log.assignment()},
+		  mailboxes_(std::make_unique<Mailbox[]>(pool.num_workers())) {
+		pool_.add_source(WorkSource{&run_source, &has_work, this});
+	}
+
+	~ScheduleReplayer() { pool_.remove_source(this); }
+
+	ScheduleReplayer(const ScheduleReplayer &) = delete;
+	ScheduleReplayer &operator=(const ScheduleReplayer &) = delete;
+
+	template<typename F>
+	void spawn(F &&f) {
+		const auto id = naming_.next_id();
+		auto body = [this, id, f = std::forward<F>(f)]() mutable { naming_.run_as(id, f); };
+		const auto it = assignment_.find(id);
+		if (it == assignment_.end() || it->second < 0 || static_cast<size_t>(it->second) >= pool_.num_workers()) {
+			unmatched_.fetch_add(1, std::memory_order_relaxed);
+			pool_.submit(std::move(body));
+			return;
+		}
+		auto &mailbox = mailboxes_[static_cast<size_t>(it->second)];
+		{
+			std::lock_guard lock(mailbox.mutex);
+			mailbox.tasks.push_back(make_task(std::move(body)));
+		}
+		mailbox.queued.fetch_add(1, std::memory_order_seq_cst);
+		pool_.notify();
+	}
+
+	// Tasks spawned that the log had no worker for.
+	[[nodiscard]]
+	size_t unmatched() const noexcept { return unmatched_.load(std::memory_order_relaxed); }
+
+private:
+	struct alignas(kCacheLineSize) Mailbox {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		// Readable without the lock, for has_work().
+		std::atomic<size_t> queued{0};
+	};
+
+	static bool run_source(void *p) {
+		auto &self = *static_cast<ScheduleReplayer *>(p);
+		const auto id = self.pool_.worker_index();
+		if (!id)
+			return false;
+		auto &mailbox = self.mailboxes_[*id];
+		Task task;
+		{
+			std::lock_guard lock(mailbox.mutex);
+			if (mailbox.tasks.empty())
+				return false;
+			task = mailbox.tasks.front();
+			mailbox.tasks.pop_front();
+		}
+		mailbox.queued.fetch_sub(1, std::memory_order_relaxed);
+		task();
+		return true;
+	}
+
+	// Only the calling worker's mailbox counts: the others' tasks are not for it, and reporting
+	// them would keep it spinning through run_source() instead of sleeping.
+	static bool has_work(const void *p) {
+		const auto &self = *static_cast<const ScheduleReplayer *>(p);
+		const auto id = self.pool_.worker_index();
+		return id && self.mailboxes_[*id].queued.load(std::memory_order_seq_cst) != 0;
+	}
+
+	WorkStealingPool &pool_;
+	TaskNaming naming_;
+	std::unordered_map<std::uint64_t, std::int32_t> assignment_;
+	std::unique_ptr<Mailbox[]> mailboxes_;
+	alignas(kCacheLineSize) std::atomic<size_t> unmatched_{0};
+};
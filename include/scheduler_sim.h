@@ -0,0 +1,307 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// One task of a recorded DAG. parent is -1 for roots; spawn_offset_ns is when the parent spawned
+// it, relative to the parent's start; work_ns is how long the task itself ran.
+struct TraceNode {
+	std::int64_t parent = -1;
+	std::uint64_t work_ns = 0;
+	std::uint64_t spawn_offset_ns = 0;
+};
+
+// Task DAG trace. Text format: one "parent work_ns spawn_offset_ns" line per task, in id order.
+struct TaskDag {
+	std::vector<TraceNode> nodes;
+
+	void save(std::ostream &out) const {
+		for (const auto &n: nodes) {
+			out << n.parent << ' ' << n.work_ns << ' ' << n.spawn_offset_ns << '\n';
+		}
+	}
+
+	[[nodiscard]]
+	static TaskDag load(std::istream &in) {
+		TaskDag dag;
+		TraceNode n;
+		while (in >> n.parent >> n.work_ns >> n.spawn_offset_ns) {
+			if (n.parent >= static_cast<std::int64_t>(dag.nodes.size())) {
+				throw std::runtime_error("trace node " + std::to_string(dag.nodes.size()) +
+				                         " refers to a later parent");
+			}
+			dag.nodes.push_back(n);
+		}
+		return dag;
+	}
+};
+
+// Records the DAG of tasks spawned through it on a WorkStealingPool. A task's parent is the
+// recorded task running on the spawning thread. Work times include anything the task ran while
+// helping inside a wait(), so record programs whose tasks don't block.
+class DagRecorder {
+public:
+	template<typename F>
+	void spawn(WorkStealingPool &pool, F &&f) {
+		const auto now = std::chrono::steady_clock::now();
+		std::int64_t id;
+		{
+			std::lock_guard lock(mutex_);
+			id = static_cast<std::int64_t>(dag_.nodes.size());
+			dag_.nodes.push_back({current_.id, 0, current_.id < 0 ? 0 : elapsed_ns(current_.start, now)});
+		}
+		pool.submit([this, id, f = std::forward<F>(f)]() mutable {
+			const auto outer = std::exchange(current_, Running{id, std::chrono::steady_clock::now()});
+			f();
+			const auto work = elapsed_ns(current_.start, std::chrono::steady_clock::now());
+			current_ = outer;
+			std::lock_guard lock(mutex_);
+			dag_.nodes[static_cast<size_t>(id)].work_ns = work;
+		});
+	}
+
+	// Call once every recorded task has finished.
+	[[nodiscard]]
+	TaskDag take() {
+		std::lock_guard lock(mutex_);
+		return std::exchange(dag_, {});
+	}
+
+private:
+	struct Running {
+		std::int64_t id;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	static std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point from,
+	                                std::chrono::steady_clock::time_point to) {
+		return static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+	}
+
+	static inline thread_local Running current_{-1, {}};
+
+	std::mutex mutex_;
+	TaskDag dag_;
+};
+
+// Cost of one queue operation in ns, e.g. as printed by WSQBench.
+struct QueueOpCosts {
+	std::uint64_t emplace_ns = 5;
+	std::uint64_t pop_ns = 5;
+	std::uint64_t steal_ns = 40;
+};
+
+enum class VictimPolicy { Random, RoundRobin, MostLoaded };
+
+struct SchedulerPolicy {
+	size_t workers = 4;
+	VictimPolicy victim = VictimPolicy::Random;
+	size_t steal_batch = 1;
+	size_t capacity = WorkStealingPool::kQueueCapacity;
+};
+
+struct SimulationResult {
+	std::uint64_t makespan_ns = 0;
+	std::uint64_t total_work_ns = 0;
+	size_t tasks = 0;
+	size_t steals = 0;
+	size_t failed_steals = 0;
+	size_t overflows = 0;
+};
+
+// Discrete-event replay of a TaskDag on a modelled work-stealing pool: per-worker deques with
+// LIFO pop and FIFO steal, children becoming visible at their recorded spawn offsets, and a fixed
+// cost per emplace/pop/steal. Children spawned into a full deque run inline after their parent,
+// like WorkStealingPool::submit().
+class SchedulerSimulator {
+public:
+	SchedulerSimulator(const TaskDag &dag, QueueOpCosts costs)
+		: dag_{dag}, costs_{costs}, children_(dag.nodes.size()) {
+		for (size_t i = 0; i < dag.nodes.size(); ++i) {
+			if (dag.nodes[i].parent >= 0) {
+				children_[static_cast<size_t>(dag.nodes[i].parent)].push_back(i);
+			}
+		}
+	}
+
+	[[nodiscard]]
+	SimulationResult run(const SchedulerPolicy &policy, std::uint64_t seed = 1) const {
+		State s(policy, seed);
+		SimulationResult result;
+		result.tasks = dag_.nodes.size();
+		for (const auto &n: dag_.nodes) {
+			result.total_work_ns += n.work_ns;
+		}
+		// Roots start on worker 0, the others start by looking for work.
+		for (size_t i = 0; i < dag_.nodes.size(); ++i) {
+			if (dag_.nodes[i].parent < 0) {
+				s.deques[0].push_back(i);
+			}
+		}
+		for (size_t w = 0; w < policy.workers; ++w) {
+			s.events.push({0, Event::Free, w, 0});
+		}
+
+		size_t finished = 0;
+		while (!s.events.empty() && finished < dag_.nodes.size()) {
+			const auto e = s.events.top();
+			s.events.pop();
+			if (e.kind == Event::Spawn) {
+				if (s.deques[e.worker].size() >= policy.capacity) {
+					++result.overflows;
+					s.inline_tasks[e.worker].push_back(e.task);
+				} else {
+					s.deques[e.worker].push_back(e.task);
+				}
+				continue;
+			}
+			if (e.kind == Event::Finish) {
+				++finished;
+				result.makespan_ns = std::max(result.makespan_ns, e.time);
+			}
+			next_task(s, e.worker, e.time, result);
+		}
+		return result;
+	}
+
+private:
+	struct Event {
+		enum Kind { Spawn, Free, Finish };
+
+		std::uint64_t time;
+		Kind kind;
+		size_t worker;
+		size_t task;
+
+		bool operator>(const Event &other) const {
+			// Spawns before other events at the same time so thieves can see them.
+			return time != other.time ? time > other.time : kind > other.kind;
+		}
+	};
+
+	struct State {
+		State(const SchedulerPolicy &policy, std::uint64_t seed)
+			: policy{policy}, deques(policy.workers), inline_tasks(policy.workers), rng{seed} {
+		}
+
+		const SchedulerPolicy &policy;
+		std::vector<std::deque<size_t> > deques;
+		std::vector<std::deque<size_t> > inline_tasks;
+		std::priority_queue<Event, std::vector<Event>, std::greater<> > events;
+		std::mt19937_64 rng;
+		size_t round_robin = 0;
+	};
+
+	void next_task(State &s, size_t w, std::uint64_t now, SimulationResult &result) const {
+		const auto idle_since = now;
+		if (!s.inline_tasks[w].empty()) {
+			const auto task = s.inline_tasks[w].front();
+			s.inline_tasks[w].pop_front();
+			start(s, w, task, now);
+			return;
+		}
+		now += costs_.pop_ns;
+		if (!s.deques[w].empty()) {
+			const auto task = s.deques[w].back();
+			s.deques[w].pop_back();
+			start(s, w, task, now);
+			return;
+		}
+		if (s.policy.workers > 1) {
+			now += costs_.steal_ns;
+			auto &victim = s.deques[pick_victim(s, w)];
+			if (!victim.empty()) {
+				++result.steals;
+				const auto task = victim.front();
+				victim.pop_front();
+				// The rest of a batch lands on the thief's own deque, oldest first.
+				for (size_t k = 1; k < s.policy.steal_batch && !victim.empty() &&
+				                   s.deques[w].size() < s.policy.capacity; ++k) {
+					s.deques[w].push_back(victim.front());
+					victim.pop_front();
+					now += costs_.emplace_ns;
+				}
+				start(s, w, task, now);
+				return;
+			}
+			++result.failed_steals;
+		}
+		// Always let simulated time advance, even with zero-cost operations.
+		s.events.push({std::max(now, idle_since + 1), Event::Free, w, 0});
+	}
+
+	size_t pick_victim(State &s, size_t thief) const {
+		const auto n = s.policy.workers;
+		switch (s.policy.victim) {
+			case VictimPolicy::RoundRobin:
+				s.round_robin = (s.round_robin + 1) % n;
+				return s.round_robin == thief ? (s.round_robin + 1) % n : s.round_robin;
+			case VictimPolicy::MostLoaded: {
+				size_t best = (thief + 1) % n;
+				for (size_t v = 0; v < n; ++v) {
+					if (v != thief && s.deques[v].size() > s.deques[best].size()) {
+						best = v;
+					}
+				}
+				return best;
+			}
+			case VictimPolicy::Random:
+			default:
+				return (thief + 1 + s.rng() % (n - 1)) % n;
+		}
+	}
+
+	void start(State &s, size_t w, size_t task, std::uint64_t now) const {
+		const auto &kids = children_[task];
+		for (size_t k = 0; k < kids.size(); ++k) {
+			const auto at = now + dag_.nodes[kids[k]].spawn_offset_ns + (k + 1) * costs_.emplace_ns;
+			s.events.push({at, Event::Spawn, w, kids[k]});
+		}
+		const auto end = now + dag_.nodes[task].work_ns + kids.size() * costs_.emplace_ns;
+		s.events.push({end, Event::Finish, w, task});
+	}
+
+	const TaskDag &dag_;
+	QueueOpCosts costs_;
+	std::vector<std::vector<size_t> > children_;
+};
@@ -0,0 +1,299 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// WorkStealingQueue variant that can live in memory shared between processes: the ring is stored
+// inline (no pointers, no allocator), so the object is position independent and can be mapped at
+// different addresses, and T must be trivially copyable so slots never own process-local memory.
+// Same protocol as WorkStealingQueue; the atomics are lock-free and therefore address-free.
+template<typename T, size_t Capacity>
+class SharedWorkStealingQueue {
+	static_assert((Capacity & (Capacity - 1)) == 0,
+	              "Capacity must be power of two");
+	static_assert(Capacity > 0, "Capacity must be positive");
+	static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+	static_assert(std::atomic<long long>::is_always_lock_free,
+	              "process-shared atomics must be lock-free");
+
+public:
+	SharedWorkStealingQueue() = default;
+
+	SharedWorkStealingQueue(const SharedWorkStealingQueue &) = delete;
+	SharedWorkStealingQueue &operator=(const SharedWorkStealingQueue &) = delete;
+
+	[[nodiscard]]
+	size_t capacity() const noexcept { return Capacity; }
+
+	[[nodiscard]]
+	size_t size() const noexcept {
+		const auto bottom = bottom_.load(std::memory_order_acquire);
+		const auto top = top_.load(std::memory_order_acquire);
+		return bottom >= top ? static_cast<size_t>(bottom - top) : 0;
+	}
+
+	[[nodiscard]]
+	bool empty() const noexcept { return size() == 0; }
+
+	void emplace(const T &item) noexcept {
+		do {
+		} while (!try_emplace(item));
+	}
+
+	[[nodiscard]]
+	bool try_emplace(const T &item) noexcept {
+		const auto write_idx = bottom_.load(std::memory_order_relaxed);
+		const auto top = top_.load(std::memory_order_acquire);
+		if (write_idx - top >= static_cast<long long>(Capacity)) {
+			return false;
+		}
+		buffer_[write_idx & kMask] = item;
+		bottom_.store(write_idx + 1, std::memory_order_release);
+		return true;
+	}
+
+	[[nodiscard]]
+	std::optional<T> pop() noexcept {
+		const auto pop_idx = bottom_.load(std::memory_order_relaxed) - 1;
+		bottom_.store(pop_idx, std::memory_order_seq_cst);
+		auto top = top_.load(std::memory_order_seq_cst);
+		if (pop_idx < top) {
+			bottom_.store(pop_idx + 1, std::memory_order_relaxed);
+			return std::nullopt;
+		}
+		const T out = buffer_[pop_idx & kMask];
+		if (pop_idx == top) {
+			// Race against thieves for the last element.
+			const bool won = top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+			                                              std::memory_order_relaxed);
+			bottom_.store(pop_idx + 1, std::memory_order_relaxed);
+			if (!won) {
+				return std::nullopt;
+			}
+		}
+		return out;
+	}
+
+	[[nodiscard]]
+	std::optional<T> steal() noexcept {
+		auto steal_idx = top_.load(std::memory_order_acquire);
+		const auto bottom = bottom_.load(std::memory_order_acquire);
+		if (steal_idx >= bottom) {
+			return std::nullopt;
+		}
+		const T out = buffer_[steal_idx & kMask];
+		if (top_.compare_exchange_strong(steal_idx, steal_idx + 1, std::memory_order_seq_cst,
+		                                 std::memory_order_relaxed)) {
+			return out;
+		}
+		return std::nullopt;
+	}
+
+private:
+	static constexpr size_t kMask = Capacity - 1;
+
+	alignas(kCacheLineSize) std::atomic<long long> top_{0};
+	alignas(kCacheLineSize) std::atomic<long long> bottom_{0};
+	alignas(kCacheLineSize) T buffer_[Capacity];
+};
+
+// A POSIX shared memory object (shm_open/mmap) holding count queues. One process create()s it,
+// the others open() it by name and steal from each other's queues. The creator unlinks the name
+// when its handle is destroyed; existing mappings stay valid until every process unmaps them.
+template<typename Queue>
+class SharedQueueSet {
+public:
+	[[nodiscard]]
+	static SharedQueueSet create(const std::string &name, size_t count) {
+		const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd == -1) {
+			throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+		}
+		const auto bytes = mapping_size(count);
+		if (::ftruncate(fd, static_cast<off_t>(bytes)) == -1) {
+			const int err = errno;
+			::close(fd);
+			::shm_unlink(name.c_str());
+			throw std::system_error(err, std::generic_category(), "ftruncate " + name);
+		}
+		void *base;
+		try {
+			base = map(fd, bytes, name);
+		} catch (...) {
+			::shm_unlink(name.c_str());
+			throw;
+		}
+		SharedQueueSet set(name, base, bytes, true);
+		auto *header = new(set.base_) Header{};
+		for (size_t i = 0; i < count; ++i) {
+			new(set.queue_address(i)) Queue();
+		}
+		header->count = count;
+		header->ready.store(kMagic, std::memory_order_release);
+		return set;
+	}
+
+	// Waits up to timeout for the creator to size the object and finish constructing the queues,
+	// backing off between checks; throws std::system_error(timed_out) if it never does, e.g.
+	// because the creator died half-way.
+	[[nodiscard]]
+	static SharedQueueSet open(const std::string &name,
+	                           std::chrono::milliseconds timeout = std::chrono::seconds(5)) {
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		const int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd == -1) {
+			throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+		}
+		struct stat st{};
+		for (unsigned attempt = 0;; ++attempt) {
+			if (::fstat(fd, &st) == -1) {
+				const int err = errno;
+				::close(fd);
+				throw std::system_error(err, std::generic_category(), "fstat " + name);
+			}
+			if (static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+				break;
+			}
+			// The creator may not have sized the object yet.
+			if (!back_off(attempt, deadline)) {
+				::close(fd);
+				throw std::system_error(std::make_error_code(std::errc::timed_out), "open " + name);
+			}
+		}
+		const auto bytes = static_cast<size_t>(st.st_size);
+		SharedQueueSet set(name, map(fd, bytes, name), bytes, false);
+		for (unsigned attempt = 0; set.header()->ready.load(std::memory_order_acquire) != kMagic; ++attempt) {
+			if (!back_off(attempt, deadline)) {
+				throw std::system_error(std::make_error_code(std::errc::timed_out), "open " + name);
+			}
+		}
+		if (mapping_size(set.size()) != bytes) {
+			throw std::runtime_error("shared queue set " + name + " has unexpected layout");
+		}
+		return set;
+	}
+
+	SharedQueueSet(SharedQueueSet &&other) noexcept
+		: name_{std::move(other.name_)},
+		  base_{std::exchange(other.base_, nullptr)},
+		  bytes_{other.bytes_},
+		  owner_{std::exchange(other.owner_, false)} {
+	}
+
+	SharedQueueSet &operator=(SharedQueueSet &&) = delete;
+
+	~SharedQueueSet() {
+		if (base_) {
+			::munmap(base_, bytes_);
+		}
+		if (owner_) {
+			::shm_unlink(name_.c_str());
+		}
+	}
+
+	[[nodiscard]]
+	size_t size() const noexcept { return header()->count; }
+
+	[[nodiscard]]
+	Queue &operator[](size_t i) noexcept { return *std::launder(static_cast<Queue *>(queue_address(i))); }
+
+private:
+	static constexpr std::uint64_t kMagic = 0x5753515348514d31; // "WSQSHQM1"
+
+	struct Header {
+		std::atomic<std::uint64_t> ready{0};
+		size_t count{0};
+	};
+
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+	static constexpr size_t kQueueStride = (sizeof(Queue) + alignof(Queue) - 1) / alignof(Queue) * alignof(Queue);
+	static constexpr size_t kQueuesOffset =
+			(sizeof(Header) + alignof(Queue) - 1) / alignof(Queue) * alignof(Queue);
+
+	static size_t mapping_size(size_t count) noexcept { return kQueuesOffset + count * kQueueStride; }
+
+	// Yield for the first few attempts, then sleep for exponentially longer, up to 1ms. Returns
+	// false once deadline has passed.
+	static bool back_off(unsigned attempt, std::chrono::steady_clock::time_point deadline) {
+		if (std::chrono::steady_clock::now() >= deadline) {
+			return false;
+		}
+		if (attempt < 16) {
+			std::this_thread::yield();
+		} else {
+			std::this_thread::sleep_for(std::chrono::microseconds(1u << std::min(attempt - 16, 10u)));
+		}
+		return true;
+	}
+
+	static void *map(int fd, size_t bytes, const std::string &name) {
+		void *p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		const int err = errno;
+		::close(fd);
+		if (p == MAP_FAILED) {
+			throw std::system_error(err, std::generic_category(), "mmap " + name);
+		}
+		return p;
+	}
+
+	SharedQueueSet(std::string name, void *base, size_t bytes, bool owner) noexcept
+		: name_{std::move(name)}, base_{base}, bytes_{bytes}, owner_{owner} {
+	}
+
+	[[nodiscard]]
+	Header *header() const noexcept { return std::launder(static_cast<Header *>(base_)); }
+
+	[[nodiscard]]
+	void *queue_address(size_t i) const noexcept {
+		return static_cast<std::byte *>(base_) + kQueuesOffset + i * kQueueStride;
+	}
+
+	std::string name_;
+	void *base_;
+	size_t bytes_;
+	bool owner_;
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+
+// Runs the tasks posted to it one at a time, in post order, on a WorkStealingPool; different
+// strands run in parallel. Posts go onto a lock-free multi-producer single-consumer list and at
+// most one drain task per strand is queued on the pool at any time, so a strand replaces a
+// per-key mutex without ever blocking a worker. The strand must be idle when destroyed.
+class Strand {
+public:
+	explicit Strand(WorkStealingPool &pool)
+		: pool_{pool},
+		  head_{new Node{}} {
+		tail_ = head_.load(std::memory_order_relaxed);
+	}
+
+	~Strand() { delete tail_; }
+
+	Strand(const Strand &) = delete;
+	Strand &operator=(const Strand &) = delete;
+
+	// Callable from any thread. Tasks posted by one thread run in the order they were posted.
+	void post(Task task) {
+		auto *node = new Node{task};
+		// Vyukov's MPSC push: claim the head, then link the previous head to the new node.
+		auto *prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+		if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0)
+			pool_.submit(Task{&drain, this});
+	}
+
+	template<typename F>
+		requires (std::is_invocable_v<std::decay_t<F> &> && !std::is_same_v<std::decay_t<F>, Task>)
+	void post(F &&f) {
+		post(make_task(std::forward<F>(f)));
+	}
+
+	// Posted tasks that have not finished yet.
+	[[nodiscard]]
+	size_t pending() const noexcept { return pending_.load(std::memory_order_acquire); }
+
+private:
+	struct Node {
+		Task task{};
+		std::atomic<Node *> next{nullptr};
+	};
+
+	// Consumer side, only ever run by the single drain task.
+	Task pop() {
+		auto *tail = tail_;
+		auto *next = tail->next.load(std::memory_order_acquire);
+		// pending_ says a node is there; its producer may not have linked it yet.
+		while (next == nullptr) {
+			std::this_thread::yield();
+			next = tail->next.load(std::memory_order_acquire);
+		}
+		// next becomes the new stub.
+		const auto task = next->task;
+		tail_ = next;
+		delete tail;
+		return task;
+	}
+
+	// Run up to kMaxDrain tasks, then requeue through the injection queue so one busy strand
+	// cannot monopolize a worker: pushing onto the worker's own deque would have its next LIFO
+	// pop take the drain straight back, ahead of everything else queued there.
+	static void drain(void *p) {
+		auto &self = *static_cast<Strand *>(p);
+		for (size_t ran = 0; ran < kMaxDrain; ++ran) {
+			self.pop()();
+			if (self.pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				return;
+		}
+		self.pool_.inject(Task{&drain, &self});
+	}
+
+	static constexpr size_t kMaxDrain = 64;
+
+	WorkStealingPool &pool_;
+	alignas(kCacheLineSize) std::atomic<Node *> head_;
+	alignas(kCacheLineSize) Node *tail_ = nullptr;
+	alignas(kCacheLineSize) std::atomic<size_t> pending_{0};
+};
@@ -0,0 +1,255 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Isolated group of tasks run by at most max_concurrency threads at a time, borrowed from a
+// WorkStealingPool. The arena has one WorkStealingQueue per slot. Pool workers that run out of
+// pool work join a free slot, run arena tasks for a while and leave; other threads join for the
+// duration of execute(). A thread blocked in the arena's wait() only runs the arena's tasks, so a
+// subsystem never picks up another's work while waiting for its own.
+// Destroy the arena, idle, before its pool.
+class TaskArena {
+public:
+	static constexpr size_t kQueueCapacity = WorkStealingPool::kQueueCapacity;
+	using Queue = WorkStealingQueue<Task, kQueueCapacity>;
+
+	TaskArena(WorkStealingPool &pool, size_t max_concurrency)
+		: pool_{pool},
+		  occupied_(std::make_unique<std::atomic<bool>[]>(std::max<size_t>(max_concurrency, 1))) {
+		max_concurrency = std::max<size_t>(max_concurrency, 1);
+		queues_.reserve(max_concurrency);
+		for (size_t i = 0; i < max_concurrency; ++i)
+			queues_.push_back(std::make_unique<Queue>());
+		pool_.add_source(WorkSource{&run_source, &has_work, this});
+	}
+
+	~TaskArena() { pool_.remove_source(this); }
+
+	TaskArena(const TaskArena &) = delete;
+	TaskArena &operator=(const TaskArena &) = delete;
+
+	[[nodiscard]]
+	size_t max_concurrency() const noexcept { return queues_.size(); }
+
+	// Threads currently joined to the arena.
+	[[nodiscard]]
+	size_t active() const noexcept { return active_.load(std::memory_order_relaxed); }
+
+	// Arena the calling thread is joined to, or nullptr.
+	[[nodiscard]]
+	static TaskArena *current() noexcept { return tls_arena_; }
+
+	// From inside the arena, push onto the caller's slot queue (running the task inline if it is
+	// full); from outside, hand it to the arena's injection queue.
+	void submit(Task task) {
+		if (tls_arena_ == this) {
+			if (!queues_[tls_slot_]->try_emplace(task)) {
+				task();
+				return;
+			}
+		} else {
+			std::lock_guard lock(injection_mutex_);
+			injection_.push_back(task);
+			injected_.fetch_add(1, std::memory_order_release);
+		}
+		pool_.notify();
+	}
+
+	template<typename F>
+		requires (std::is_invocable_v<std::decay_t<F> &> && !std::is_same_v<std::decay_t<F>, Task>)
+	void submit(F &&f) {
+		submit(make_task(std::forward<F>(f)));
+	}
+
+	// Run f with the calling thread joined to the arena, waiting for a free slot if necessary.
+	template<typename F>
+	decltype(auto) execute(F &&f) {
+		if (tls_arena_ == this)
+			return std::forward<F>(f)();
+		std::optional<size_t> slot;
+		while (!(slot = join()))
+			std::this_thread::yield();
+		Membership membership(*this, *slot);
+		return std::forward<F>(f)();
+	}
+
+	// Run one of the arena's tasks on the calling thread, which must be joined to the arena.
+	bool run_one() {
+		if (auto task = find_task()) {
+			(*task)();
+			return true;
+		}
+		return false;
+	}
+
+	// Help with the arena's tasks, and only those, until pending drops to zero.
+	void wait(const std::atomic<size_t> &pending) {
+		execute([&] {
+			while (pending.load(std::memory_order_acquire) != 0) {
+				if (!run_one())
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	// WorkStealingPool::parallel_for confined to the arena.
+	template<SplittableRange R, typename Body>
+		requires std::is_invocable_v<const Body &, const R &>
+	void parallel_for(const R &range, const Body &body) {
+		execute([&] {
+			std::atomic<size_t> pending{1};
+			using Node = ForTask<TaskArena, R, Body>;
+			submit(Task{&Node::run, new Node{range, &body, &pending, this}});
+			wait(pending);
+		});
+	}
+
+	template<typename F>
+		requires std::is_invocable_v<const F &, size_t>
+	void parallel_for(size_t begin, size_t end, size_t grain, const F &f) {
+		parallel_for(BlockedRange(begin, end, grain), [&f](const BlockedRange &r) {
+			for (auto i = r.begin(); i != r.end(); ++i)
+				f(i);
+		});
+	}
+
+private:
+	// Binds the calling thread to an already acquired slot; on exit frees the slot and restores
+	// the arena the thread was in before.
+	class Membership {
+	public:
+		Membership(TaskArena &arena, size_t slot)
+			: arena_{arena}, prev_arena_{tls_arena_}, prev_slot_{tls_slot_}, slot_{slot} {
+			tls_arena_ = &arena;
+			tls_slot_ = slot;
+		}
+
+		~Membership() {
+			tls_arena_ = prev_arena_;
+			tls_slot_ = prev_slot_;
+			arena_.leave(slot_);
+		}
+
+		Membership(const Membership &) = delete;
+		Membership &operator=(const Membership &) = delete;
+
+	private:
+		TaskArena &arena_;
+		TaskArena *prev_arena_;
+		size_t prev_slot_;
+		size_t slot_;
+	};
+
+	std::optional<size_t> join() noexcept {
+		for (size_t i = 0; i < queues_.size(); ++i) {
+			if (!occupied_[i].load(std::memory_order_relaxed) &&
+			    !occupied_[i].exchange(true, std::memory_order_acquire)) {
+				active_.fetch_add(1, std::memory_order_relaxed);
+				return i;
+			}
+		}
+		return std::nullopt;
+	}
+
+	void leave(size_t slot) noexcept {
+		active_.fetch_sub(1, std::memory_order_relaxed);
+		// Publishes the slot queue's owner-side state to the next thread that joins it.
+		occupied_[slot].store(false, std::memory_order_release);
+	}
+
+	std::optional<Task> find_task() {
+		if (tls_arena_ == this) {
+			if (auto task = queues_[tls_slot_]->pop())
+				return task;
+		}
+		for (size_t k = 0; k < queues_.size(); ++k) {
+			if (tls_arena_ == this && k == tls_slot_)
+				continue;
+			// Slots nobody occupies still hold tasks left behind by workers that moved on.
+			if (auto task = queues_[k]->steal())
+				return task;
+		}
+		if (injected_.load(std::memory_order_acquire) == 0)
+			return std::nullopt;
+		std::lock_guard lock(injection_mutex_);
+		if (injection_.empty())
+			return std::nullopt;
+		const auto task = injection_.front();
+		injection_.pop_front();
+		injected_.fetch_sub(1, std::memory_order_relaxed);
+		return task;
+	}
+
+	// WorkSource hooks for the pool's idle workers: join a free slot, run up to kStint tasks so
+	// the worker returns to the pool regularly, then leave.
+	static bool run_source(void *p) {
+		auto &self = *static_cast<TaskArena *>(p);
+		const auto slot = self.join();
+		if (!slot)
+			return false;
+		Membership membership(self, *slot);
+		size_t ran = 0;
+		while (ran < kStint && self.run_one())
+			++ran;
+		return ran != 0;
+	}
+
+	static bool has_work(const void *p) {
+		const auto &self = *static_cast<const TaskArena *>(p);
+		if (self.active_.load(std::memory_order_relaxed) >= self.queues_.size())
+			return false;
+		if (self.injected_.load(std::memory_order_seq_cst) != 0)
+			return true;
+		return std::ranges::any_of(self.queues_, [](const auto &q) { return !q->empty(); });
+	}
+
+	static constexpr size_t kStint = 256;
+
+	static inline thread_local TaskArena *tls_arena_ = nullptr;
+	static inline thread_local size_t tls_slot_ = 0;
+
+	WorkStealingPool &pool_;
+	std::vector<std::unique_ptr<Queue> > queues_;
+	std::unique_ptr<std::atomic<bool>[]> occupied_;
+	alignas(kCacheLineSize) std::atomic<size_t> active_{0};
+
+	std::mutex injection_mutex_;
+	std::deque<Task> injection_;
+	alignas(kCacheLineSize) std::atomic<size_t> injected_{0};
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Latency histogram with power-of-two nanosecond buckets: bucket b counts samples in
+// [2^(b-1), 2^b). Histograms from different threads or runs merge by adding buckets.
+struct LogHistogram {
+	static constexpr size_t kBuckets = 64;
+
+	std::array<std::uint64_t, kBuckets> buckets{};
+	std::uint64_t count = 0;
+	std::uint64_t sum_ns = 0;
+	std::uint64_t max_ns = 0;
+
+	[[nodiscard]]
+	static constexpr size_t bucket_of(std::uint64_t ns) noexcept {
+		return std::min<size_t>(static_cast<size_t>(std::bit_width(ns)), kBuckets - 1);
+	}
+
+	void record(std::uint64_t ns) noexcept {
+		++buckets[bucket_of(ns)];
+		++count;
+		sum_ns += ns;
+		max_ns = std::max(max_ns, ns);
+	}
+
+	LogHistogram &operator+=(const LogHistogram &o) noexcept {
+		for (size_t b = 0; b < kBuckets; ++b)
+			buckets[b] += o.buckets[b];
+		count += o.count;
+		sum_ns += o.sum_ns;
+		max_ns = std::max(max_ns, o.max_ns);
+		return *this;
+	}
+
+	[[nodiscard]]
+	double mean_ns() const noexcept { return count ? static_cast<double>(sum_ns) / count : 0.0; }
+
+	// Upper bound of the bucket holding the q-quantile (0 < q <= 1).
+	[[nodiscard]]
+	std::uint64_t percentile_ns(double q) const noexcept {
+		const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count) + 0.5);
+		std::uint64_t seen = 0;
+		for (size_t b = 0; b < kBuckets; ++b) {
+			seen += buckets[b];
+			if (seen >= std::max<std::uint64_t>(rank, 1))
+				return std::min(b == 0 ? 0 : (std::uint64_t{1} << b) - 1, max_ns);
+		}
+		return max_ns;
+	}
+};
+
+// Per-type profile: how long tasks waited in a WorkStealingQueue (spawn to start) and how long
+// they ran.
+struct TaskTypeProfile {
+	LogHistogram queueing;
+	LogHistogram execution;
+
+	TaskTypeProfile &operator+=(const TaskTypeProfile &o) noexcept {
+		queueing += o.queueing;
+		execution += o.execution;
+		return *this;
+	}
+};
+
+// Optional per-task-type profiling for a WorkStealingPool. Tasks opt in by being wrapped with a
+// type id; the wrapper stamps the spawn time and, when a worker starts it, records queueing and
+// execution time into that worker's histograms. snapshot() merges the per-worker histograms.
+// Untagged tasks are unaffected.
+class TaskTypeProfiler {
+public:
+	TaskTypeProfiler(WorkStealingPool &pool, size_t num_types)
+		: pool_{pool},
+		  num_types_{num_types},
+		  // One slot set per worker plus one shared by non-worker threads.
+		  slots_(std::make_unique<Slot[]>((pool.num_workers() + 1) * num_types)) {
+	}
+
+	[[nodiscard]]
+	size_t num_types() const noexcept { return num_types_; }
+
+	// Tag task with type (< num_types()). The returned task must be run exactly once.
+	[[nodiscard]]
+	Task wrap(std::uint32_t type, Task task) {
+		assert(type < num_types_);
+		return Task{&run, new Tagged{task, this, type, now_ns()}};
+	}
+
+	template<typename F>
+	void submit(std::uint32_t type, F &&f) {
+		pool_.submit(wrap(type, make_task(std::forward<F>(f))));
+	}
+
+	void submit(std::uint32_t type, Task task) { pool_.submit(wrap(type, task)); }
+
+	[[nodiscard]]
+	std::vector<TaskTypeProfile> snapshot() const {
+		std::vector<TaskTypeProfile> merged(num_types_);
+		for (size_t w = 0; w <= pool_.num_workers(); ++w) {
+			for (size_t t = 0; t < num_types_; ++t)
+				merged[t] += slots_[w * num_types_ + t].snapshot();
+		}
+		return merged;
+	}
+
+	static void print(std::ostream &out, std::span<const TaskTypeProfile> profiles,
+	                  std::span<const std::string> names = {}) {
+		out << std::setw(12) << "type" << std::setw(10) << "count"
+				<< std::setw(14) << "wait p50" << std::setw(14) << "wait p99" << std::setw(14) << "wait max"
+				<< std::setw(14) << "run p50" << std::setw(14) << "run p99" << "  (ns)\n";
+		for (size_t t = 0; t < profiles.size(); ++t) {
+			const auto &p = profiles[t];
+			out << std::setw(12) << (t < names.size() ? names[t] : std::to_string(t))
+					<< std::setw(10) << p.execution.count
+					<< std::setw(14) << p.queueing.percentile_ns(0.5) << std::setw(14) << p.queueing.percentile_ns(0.99)
+					<< std::setw(14) << p.queueing.max_ns
+					<< std::setw(14) << p.execution.percentile_ns(0.5) << std::setw(14) << p.execution.percentile_ns(0.99)
+					<< "\n";
+		}
+		out.flush();
+	}
+
+private:
+	struct Tagged {
+		Task task;
+		TaskTypeProfiler *profiler;
+		std::uint32_t type;
+		std::uint64_t spawn_ns;
+	};
+
+	// Recording side of a LogHistogram pair. Worker slots have a single writer; the shared slot
+	// for non-worker threads relies on the relaxed RMWs.
+	struct alignas(kCacheLineSize) Slot {
+		std::array<std::atomic<std::uint64_t>, LogHistogram::kBuckets> queueing{};
+		std::array<std::atomic<std::uint64_t>, LogHistogram::kBuckets> execution{};
+		std::atomic<std::uint64_t> queueing_sum{0}, queueing_max{0};
+		std::atomic<std::uint64_t> execution_sum{0}, execution_max{0};
+
+		void record(std::uint64_t wait_ns, std::uint64_t run_ns) noexcept {
+			queueing[LogHistogram::bucket_of(wait_ns)].fetch_add(1, std::memory_order_relaxed);
+			execution[LogHistogram::bucket_of(run_ns)].fetch_add(1, std::memory_order_relaxed);
+			queueing_sum.fetch_add(wait_ns, std::memory_order_relaxed);
+			execution_sum.fetch_add(run_ns, std::memory_order_relaxed);
+			raise(queueing_max, wait_ns);
+			raise(execution_max, run_ns);
+		}
+
+		[[nodiscard]]
+		TaskTypeProfile snapshot() const noexcept {
+			TaskTypeProfile p;
+			for (size_t b = 0; b < LogHistogram::kBuckets; ++b) {
+				p.queueing.buckets[b] = queueing[b].load(std::memory_order_relaxed);
+				p.execution.buckets[b] = execution[b].load(std::memory_order_relaxed);
+				p.queueing.count += p.queueing.buckets[b];
+				p.execution.count += p.execution.buckets[b];
+			}
+			p.queueing.sum_ns = queueing_sum.load(std::memory_order_relaxed);
+			p.queueing.max_ns = queueing_max.load(std::memory_order_relaxed);
+			p.execution.sum_ns = execution_sum.load(std::memory_order_relaxed);
+			p.execution.max_ns = execution_max.load(std::memory_order_relaxed);
+			return p;
+		}
+
+	private:
+		static void raise(std::atomic<std::uint64_t> &target, std::uint64_t value) noexcept {
+			auto current = target.load(std::memory_order_relaxed);
+			while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+			}
+		}
+	};
+
+	static void run(void *p) {
+		std::unique_ptr<Tagged> tagged(static_cast<Tagged *>(p));
+		const auto start = now_ns();
+		tagged->task();
+		const auto end = now_ns();
+		auto *self = tagged->profiler;
+		const auto worker = self->pool_.worker_index().value_or(self->pool_.num_workers());
+		self->slots_[worker * self->num_types_ + tagged->type].record(start - tagged->spawn_ns, end - start);
+	}
+
+	static std::uint64_t now_ns() noexcept {
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	WorkStealingPool &pool_;
+	size_t num_types_;
+	std::unique_ptr<Slot[]> slots_;
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+
+// Parse a kernel cpu list such as "0-3,8,10-11". Malformed entries are skipped.
+[[nodiscard]]
+inline std::vector<int> parse_cpu_list(std::string_view list) {
+	std::vector<int> cpus;
+	while (!list.empty()) {
+		const auto comma = list.find(',');
+		auto item = list.substr(0, comma);
+		list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+		while (!item.empty() && (item.back() == '\n' || item.back() == ' '))
+			item.remove_suffix(1);
+		int first = 0, last = 0;
+		const auto dash = item.find('-');
+		const auto lo = item.substr(0, dash);
+		if (std::from_chars(lo.data(), lo.data() + lo.size(), first).ec != std::errc{})
+			continue;
+		last = first;
+		if (dash != std::string_view::npos) {
+			const auto hi = item.substr(dash + 1);
+			if (std::from_chars(hi.data(), hi.data() + hi.size(), last).ec != std::errc{})
+				continue;
+		}
+		for (int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+	std::ranges::sort(cpus);
+	const auto [first, last] = std::ranges::unique(cpus);
+	cpus.erase(first, last);
+	return cpus;
+}
+
+// Pin the calling thread to cpu. A negative cpu leaves the thread unpinned.
+inline std::error_code pin_current_thread(int cpu) noexcept {
+	if (cpu < 0)
+		return {};
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		return {err, std::system_category()};
+	return {};
+}
+
+// Where a worker goes, in CpuTopology::plan order:
+// - Compact: fill one LLC domain at a time, SMT siblings next to each other.
+// - CoresFirst: one thread per physical core, LLC domain by LLC domain, then the second SMT
+//   thread of each core; producer/consumer pairs share a cache without sharing a core.
+// - Scatter: one thread per physical core, round-robin over NUMA nodes and LLC domains, then
+//   the SMT siblings in the same order; maximizes memory bandwidth and private cache.
+enum class Placement { Compact, CoresFirst, Scatter };
+
+struct CpuInfo {
+	int cpu = 0;
+	int core = 0; // dense physical core index
+	int smt = 0;  // rank of this cpu among its core's SMT siblings
+	int llc = 0;  // dense last-level cache domain index
+	int numa = 0;
+};
+
+// CPUs this process may run on, as read from sysfs (Linux). Only CPUs that are online, in the
+// thread's affinity mask, in the cgroup's effective cpuset and not isolated (isolcpus) are kept.
+class CpuTopology {
+public:
+	// Topology of the machine for the calling process.
+	[[nodiscard]]
+	static CpuTopology discover() {
+		return load("/sys", allowed_cpus("/sys", "/proc/self/cgroup"));
+	}
+
+	// Build from a sysfs tree rooted at sysfs_root, keeping only allowed CPUs (all online CPUs
+	// if not given). Missing files fall back to one core, LLC and node per CPU.
+	[[nodiscard]]
+	static CpuTopology load(const std::filesystem::path &sysfs_root, std::optional<std::vector<int> > allowed = {}) {
+		const auto cpu_dir = sysfs_root / "devices/system/cpu";
+		auto cpus = parse_cpu_list(read_file(cpu_dir / "online"));
+		if (allowed) {
+			std::erase_if(cpus, [&](int cpu) { return !std::ranges::binary_search(*allowed, cpu); });
+		}
+
+		std::map<int, int> numa_of;
+		for (int node = 0;; ++node) {
+			const auto node_dir = sysfs_root / "devices/system/node" / ("node" + std::to_string(node));
+			if (!std::filesystem::exists(node_dir))
+				break;
+			for (const int cpu: parse_cpu_list(read_file(node_dir / "cpulist")))
+				numa_of[cpu] = node;
+		}
+
+		CpuTopology topo;
+		std::map<std::pair<int, int>, int> core_ids; // (package, core_id) -> dense index
+		std::map<int, int> llc_ids;                  // first cpu sharing the LLC -> dense index
+		std::map<int, int> smt_count;
+		for (const int cpu: cpus) {
+			const auto dir = cpu_dir / ("cpu" + std::to_string(cpu));
+			CpuInfo info;
+			info.cpu = cpu;
+			const int package = read_int(dir / "topology/physical_package_id").value_or(0);
+			const int core_id = read_int(dir / "topology/core_id").value_or(cpu);
+			info.core = core_ids.try_emplace({package, core_id}, static_cast<int>(core_ids.size())).first->second;
+			info.smt = smt_count[info.core]++;
+			const int llc_key = last_level_cache_leader(dir).value_or(cpu);
+			info.llc = llc_ids.try_emplace(llc_key, static_cast<int>(llc_ids.size())).first->second;
+			info.numa = numa_of.contains(cpu) ? numa_of[cpu] : 0;
+			topo.cpus_.push_back(info);
+		}
+		topo.num_cores_ = core_ids.size();
+		topo.num_llcs_ = llc_ids.size();
+		std::vector<int> nodes;
+		for (const auto &c: topo.cpus_)
+			nodes.push_back(c.numa);
+		std::ranges::sort(nodes);
+		topo.num_numa_nodes_ = static_cast<size_t>(std::ranges::distance(nodes.begin(), std::ranges::unique(nodes).begin()));
+		return topo;
+	}
+
+	// Online CPUs allowed by the affinity mask and the cgroup cpuset, minus isolated CPUs.
+	[[nodiscard]]
+	static std::vector<int> allowed_cpus(const std::filesystem::path &sysfs_root,
+	                                     const std::filesystem::path &proc_cgroup) {
+		auto cpus = parse_cpu_list(read_file(sysfs_root / "devices/system/cpu/online"));
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+			std::erase_if(cpus, [&](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &mask); });
+		if (const auto cpuset = cgroup_cpuset(sysfs_root, proc_cgroup)) {
+			std::erase_if(cpus, [&](int cpu) { return !std::ranges::binary_search(*cpuset, cpu); });
+		}
+		const auto isolated = parse_cpu_list(read_file(sysfs_root / "devices/system/cpu/isolated"));
+		std::erase_if(cpus, [&](int cpu) { return std::ranges::binary_search(isolated, cpu); });
+		return cpus;
+	}
+
+	[[nodiscard]]
+	const std::vector<CpuInfo> &cpus() const noexcept { return cpus_; }
+
+	[[nodiscard]]
+	size_t num_cpus() const noexcept { return cpus_.size(); }
+
+	[[nodiscard]]
+	size_t num_cores() const noexcept { return num_cores_; }
+
+	[[nodiscard]]
+	size_t num_llcs() const noexcept { return num_llcs_; }
+
+	[[nodiscard]]
+	size_t num_numa_nodes() const noexcept { return num_numa_nodes_; }
+
+	// CPU for each of n workers. Wraps around when n exceeds the allowed CPUs; all -1 (unpinned)
+	// if no CPU is known.
+	[[nodiscard]]
+	std::vector<int> plan(size_t n, Placement placement = Placement::CoresFirst) const {
+		if (cpus_.empty())
+			return std::vector<int>(n, -1);
+		auto order = cpus_;
+		switch (placement) {
+			case Placement::Compact:
+				std::ranges::sort(order, {}, [](const CpuInfo &c) {
+					return std::tuple{c.numa, c.llc, c.core, c.smt};
+				});
+				break;
+			case Placement::CoresFirst:
+				std::ranges::sort(order, {}, [](const CpuInfo &c) {
+					return std::tuple{c.smt, c.numa, c.llc, c.core};
+				});
+				break;
+			case Placement::Scatter: {
+				// Rank each core within its (node, LLC) domain, then deal domains round-robin.
+				std::map<std::pair<int, int>, int> seen;
+				std::map<int, int> rank_of_core;
+				auto by_domain = cpus_;
+				std::ranges::sort(by_domain, {}, [](const CpuInfo &c) { return std::tuple{c.numa, c.llc, c.core}; });
+				for (const auto &c: by_domain) {
+					if (!rank_of_core.contains(c.core))
+						rank_of_core[c.core] = seen[{c.numa, c.llc}]++;
+				}
+				std::ranges::sort(order, {}, [&](const CpuInfo &c) {
+					return std::tuple{c.smt, rank_of_core[c.core], c.numa, c.llc};
+				});
+				break;
+			}
+		}
+		std::vector<int> plan(n);
+		for (size_t i = 0; i < n; ++i)
+			plan[i] = order[i % order.size()].cpu;
+		return plan;
+	}
+
+private:
+	static std::string read_file(const std::filesystem::path &path) {
+		std::ifstream in(path);
+		return std::string(std::istreambuf_iterator<char>(in), {});
+	}
+
+	static std::optional<int> read_int(const std::filesystem::path &path) {
+		const auto text = read_file(path);
+		int value = 0;
+		if (std::from_chars(text.data(), text.data() + text.size(), value).ec != std::errc{})
+			return std::nullopt;
+		return value;
+	}
+
+	// Lowest CPU sharing the highest-level data/unified cache of a cpu directory.
+	static std::optional<int> last_level_cache_leader(const std::filesystem::path &cpu_dir) {
+		int best_level = -1;
+		std::optional<int> leader;
+		for (int index = 0;; ++index) {
+			const auto dir = cpu_dir / "cache" / ("index" + std::to_string(index));
+			if (!std::filesystem::exists(dir))
+				break;
+			auto type = read_file(dir / "type");
+			if (type.starts_with("Instruction"))
+				continue;
+			const int level = read_int(dir / "level").value_or(0);
+			const auto shared = parse_cpu_list(read_file(dir / "shared_cpu_list"));
+			if (level > best_level && !shared.empty()) {
+				best_level = level;
+				leader = shared.front();
+			}
+		}
+		return leader;
+	}
+
+	// Effective cpuset of the process's cgroup (v2, then v1), if one can be read.
+	static std::optional<std::vector<int> > cgroup_cpuset(const std::filesystem::path &sysfs_root,
+	                                                      const std::filesystem::path &proc_cgroup) {
+		std::ifstream in(proc_cgroup);
+		for (std::string line; std::getline(in, line);) {
+			// hierarchy-id:controllers:path
+			const auto first = line.find(':');
+			const auto second = line.find(':', first + 1);
+			if (first == std::string::npos || second == std::string::npos)
+				continue;
+			const auto controllers = std::string_view(line).substr(first + 1, second - first - 1);
+			const auto path = std::filesystem::path(line.substr(second + 1)).relative_path();
+			std::filesystem::path file;
+			if (controllers.empty())
+				file = sysfs_root / "fs/cgroup" / path / "cpuset.cpus.effective";
+			else if (controllers.find("cpuset") != std::string_view::npos)
+				file = sysfs_root / "fs/cgroup/cpuset" / path / "cpuset.effective_cpus";
+			else
+				continue;
+			const auto cpus = parse_cpu_list(read_file(file));
+			if (!cpus.empty())
+				return cpus;
+		}
+		return std::nullopt;
+	}
+
+	std::vector<CpuInfo> cpus_;
+	size_t num_cores_ = 0;
+	size_t num_llcs_ = 0;
+	size_t num_numa_nodes_ = 0;
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "wsq.h"
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <utility>
+
+
+// WorkStealingQueue that also tracks the summed cost of its queued items, so thieves can pick
+// victims and size their steals by work rather than by item count. Cost is a default-constructible
+// callable returning the (non-negative) cost hint carried by an item.
+template<typename T, size_t Capacity, typename Cost>
+	requires std::is_invocable_r_v<size_t, const Cost &, const T &>
+class WeightedWorkStealingQueue {
+public:
+	WeightedWorkStealingQueue() = default;
+
+	WeightedWorkStealingQueue(const WeightedWorkStealingQueue &) = delete;
+	WeightedWorkStealingQueue &operator=(const WeightedWorkStealingQueue &) = delete;
+
+	[[nodiscard]]
+	size_t capacity() const noexcept { return queue_.capacity(); }
+
+	[[nodiscard]]
+	size_t size() const noexcept { return queue_.size(); }
+
+	[[nodiscard]]
+	bool empty() const noexcept { return queue_.empty(); }
+
+	// Approximate: updated with relaxed RMWs after each transfer, so it may briefly lag the queue.
+	[[nodiscard]]
+	size_t weight() const noexcept {
+		const auto w = weight_.load(std::memory_order_relaxed);
+		return w > 0 ? static_cast<size_t>(w) : 0;
+	}
+
+	template<typename... Args>
+	void emplace(Args &&... args) {
+		do {
+		} while (!try_emplace(std::forward<Args>(args)...));
+	}
+
+	template<typename... Args>
+	[[nodiscard]]
+	bool try_emplace(Args &&... args) {
+		T item(std::forward<Args>(args)...);
+		const auto cost = static_cast<long long>(cost_(item));
+		// Count the weight before publishing so a thief never drives it negative.
+		weight_.fetch_add(cost, std::memory_order_relaxed);
+		if (!queue_.try_emplace(std::move(item))) {
+			weight_.fetch_sub(cost, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	[[nodiscard]]
+	std::optional<T> pop() {
+		auto out = queue_.pop();
+		if (out)
+			weight_.fetch_sub(static_cast<long long>(cost_(*out)), std::memory_order_relaxed);
+		return out;
+	}
+
+	[[nodiscard]]
+	std::optional<T> steal() {
+		auto out = queue_.steal();
+		if (out)
+			weight_.fetch_sub(static_cast<long long>(cost_(*out)), std::memory_order_relaxed);
+		return out;
+	}
+
+	// Steal oldest items until roughly half of the queued weight has been taken. Items are claimed
+	// one CAS at a time: claiming several slots with one CAS would race the owner's CAS-free pop()
+	// path. Returns the stolen weight; at least one item is taken when the queue is non-empty.
+	template<std::output_iterator<T> OutputIt>
+	size_t steal_half(OutputIt out) {
+		const auto target = weight() / 2;
+		size_t stolen = 0;
+		do {
+			auto item = queue_.steal();
+			if (!item)
+				break;
+			const auto cost = cost_(*item);
+			weight_.fetch_sub(static_cast<long long>(cost), std::memory_order_relaxed);
+			stolen += cost;
+			*out++ = std::move(*item);
+		} while (stolen < target);
+		return stolen;
+	}
+
+private:
+	WorkStealingQueue<T, Capacity> queue_;
+	[[no_unique_address]] Cost cost_{};
+
+	// Written by the owner and every successful thief.
+	alignas(kCacheLineSize) std::atomic<long long> weight_{0};
+	alignas(kCacheLineSize) std::byte tail_guard_[kCacheLineSize]{};
+};
+
+// Pick the victim with the most queued weight, or end(queues) if every queue is empty.
+// Elements may be queues or (smart) pointers to queues.
+template<std::ranges::forward_range Queues>
+[[nodiscard]]
+auto heaviest_victim(Queues &&queues) {
+	auto weight_of = [](const auto &q) -> size_t {
+		if constexpr (requires { q.weight(); })
+			return q.weight();
+		else
+			return q->weight();
+	};
+	auto best = std::ranges::end(queues);
+	size_t best_weight = 0;
+	for (auto it = std::ranges::begin(queues); it != std::ranges::end(queues); ++it) {
+		if (const auto w = weight_of(*it); w > best_weight) {
+			best_weight = w;
+			best = it;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,235 @@
+#pragma once
+
+/*
+Copyright (c) 2025 Etienne Paquet
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include <time.h>
+
+
+// Work/span measurements of one profiled region.
+struct WorkSpanReport {
+	std::string name;
+	std::uint64_t work_ns = 0;
+	std::uint64_t span_ns = 0;
+	// Span with spawn_burden_ns added for every spawn edge on the path.
+	std::uint64_t burdened_span_ns = 0;
+	std::uint64_t spawns = 0;
+	// Pool counters over the region, with per-operation timing enabled.
+	PoolStats scheduler;
+
+	[[nodiscard]]
+	double parallelism() const noexcept { return ratio(work_ns, span_ns); }
+
+	[[nodiscard]]
+	double burdened_parallelism() const noexcept { return ratio(work_ns, burdened_span_ns); }
+
+	// Greedy-scheduler bound: min(workers, parallelism).
+	[[nodiscard]]
+	double speedup_bound(size_t workers) const noexcept {
+		return std::min(static_cast<double>(workers), parallelism());
+	}
+
+	// Burdened estimate work / (work / workers + burdened span).
+	[[nodiscard]]
+	double burdened_speedup(size_t workers) const noexcept {
+		if (work_ns == 0)
+			return 0.0;
+		const auto w = static_cast<double>(work_ns);
+		return w / (w / static_cast<double>(workers) + static_cast<double>(burdened_span_ns));
+	}
+
+	void print(std::ostream &out, size_t max_workers) const {
+		out << name << ": work " << work_ns << "ns, span " << span_ns << "ns, burdened span "
+				<< burdened_span_ns << "ns, " << spawns << " spawns\n";
+		out << "    parallelism " << std::fixed << std::setprecision(2) << parallelism()
+				<< ", burdened parallelism " << burdened_parallelism() << "\n";
+		out << "    deque overhead: emplace " << scheduler.emplace_ns << "ns (" << scheduler.emplaces
+				<< "), pop " << scheduler.pop_ns << "ns (" << scheduler.pops << "), steal "
+				<< scheduler.steal_ns << "ns (" << scheduler.steals << "/" << scheduler.steal_attempts
+				<< "), idle " << scheduler.idle_ns << "ns\n";
+		out << "    workers  speedup bound  burdened speedup\n";
+		for (size_t p = 1; p <= max_workers; p *= 2) {
+			out << std::setw(11) << p << std::setw(15) << speedup_bound(p)
+					<< std::setw(18) << burdened_speedup(p) << "\n";
+		}
+		out.flush();
+	}
+
+private:
+	static double ratio(std::uint64_t a, std::uint64_t b) noexcept {
+		return b == 0 ? 0.0 : static_cast<double>(a) / static_cast<double>(b);
+	}
+};
+
+// Cilkscale-style work/span profiler for fork-join programs on a WorkStealingPool. Inside
+// measure(), tasks are started with spawn() (or parallel_for()) and the region ends once
+// everything spawned has finished. Each task's own CPU time adds to the work; the span is the
+// longest chain of spawn offsets and CPU times through the task tree.
+//
+// Tasks should not block in wait() inside a region: time spent helping other tasks there would
+// be counted twice.
+class WorkSpanProfiler {
+public:
+	// Burden charged per spawn edge for the burdened span, standing in for the cost of a steal
+	// and migrating the task's working set to another core.
+	static constexpr std::uint64_t kDefaultSpawnBurdenNs = 1000;
+
+	explicit WorkSpanProfiler(WorkStealingPool &pool, std::uint64_t spawn_burden_ns = kDefaultSpawnBurdenNs)
+		: pool_{pool}, burden_ns_{spawn_burden_ns} {
+	}
+
+	template<typename F>
+	WorkSpanReport measure(std::string name, F &&root) {
+		Region region;
+		const auto before = pool_.stats();
+		pool_.set_timing(true);
+		start(new Strand{nullptr, &region, 0}, std::forward<F>(root));
+		pool_.wait(region.pending);
+		pool_.set_timing(false);
+
+		WorkSpanReport report;
+		report.name = std::move(name);
+		report.work_ns = region.work_ns.load(std::memory_order_relaxed);
+		report.span_ns = region.span_ns;
+		report.burdened_span_ns = region.burdened_span_ns;
+		report.spawns = region.spawns.load(std::memory_order_relaxed);
+		report.scheduler = pool_.stats() - before;
+		return report;
+	}
+
+	// Spawn f as a child of the task currently running on this thread. Only valid inside measure().
+	template<typename F>
+	void spawn(F &&f) {
+		Strand *parent = current_.strand;
+		assert(parent && "spawn() outside of a measured region");
+		parent->pending.fetch_add(1, std::memory_order_relaxed);
+		parent->region->spawns.fetch_add(1, std::memory_order_relaxed);
+		start(new Strand{parent, parent->region, cpu_now_ns() - current_.start_ns}, std::forward<F>(f));
+	}
+
+	// Recursively split range into spawned tasks calling body on each leaf. Does not block:
+	// the leaves are part of the enclosing region.
+	template<SplittableRange R, typename Body>
+	void parallel_for(const R &range, Body body) {
+		split(range, std::make_shared<const Body>(std::move(body)));
+	}
+
+private:
+	struct Region {
+		std::atomic<size_t> pending{1};
+		std::atomic<std::uint64_t> work_ns{0};
+		std::atomic<std::uint64_t> spawns{0};
+		std::uint64_t span_ns = 0;
+		std::uint64_t burdened_span_ns = 0;
+	};
+
+	struct Strand {
+		Strand *parent;
+		Region *region;
+		std::uint64_t offset_ns;
+		std::uint64_t own_ns = 0;
+		// Own execution plus unfinished children.
+		std::atomic<size_t> pending{1};
+		std::atomic<std::uint64_t> child_span_ns{0};
+		std::atomic<std::uint64_t> child_burdened_span_ns{0};
+	};
+
+	struct Running {
+		Strand *strand;
+		std::uint64_t start_ns;
+	};
+
+	template<SplittableRange R, typename Body>
+	void split(R range, std::shared_ptr<const Body> body) {
+		spawn([this, range, body]() mutable {
+			while (range.is_divisible())
+				split(range.split(), body);
+			(*body)(std::as_const(range));
+		});
+	}
+
+	template<typename F>
+	void start(Strand *strand, F &&f) {
+		pool_.submit([this, strand, f = std::forward<F>(f)]() mutable {
+			const auto outer = std::exchange(current_, Running{strand, cpu_now_ns()});
+			f();
+			strand->own_ns = cpu_now_ns() - current_.start_ns;
+			current_ = outer;
+			strand->region->work_ns.fetch_add(strand->own_ns, std::memory_order_relaxed);
+			finish(strand);
+		});
+	}
+
+	// Called when the strand's own execution or one of its children is done. The last one to
+	// finish folds the strand's span into its parent, walking up as parents complete.
+	void finish(Strand *strand) {
+		while (strand && strand->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			const auto span = std::max(strand->own_ns, strand->child_span_ns.load(std::memory_order_relaxed));
+			const auto burdened = std::max(strand->own_ns,
+			                               strand->child_burdened_span_ns.load(std::memory_order_relaxed));
+			Strand *parent = strand->parent;
+			if (parent) {
+				atomic_max(parent->child_span_ns, strand->offset_ns + span);
+				atomic_max(parent->child_burdened_span_ns, strand->offset_ns + burden_ns_ + burdened);
+			} else {
+				auto *region = strand->region;
+				region->span_ns = span;
+				region->burdened_span_ns = burdened;
+				region->pending.fetch_sub(1, std::memory_order_release);
+			}
+			delete strand;
+			strand = parent;
+		}
+	}
+
+	static void atomic_max(std::atomic<std::uint64_t> &target, std::uint64_t value) noexcept {
+		auto current = target.load(std::memory_order_relaxed);
+		while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	// Thread CPU time, so preemption by other threads doesn't inflate work or span.
+	static std::uint64_t cpu_now_ns() noexcept {
+		timespec ts{};
+		::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000u + static_cast<std::uint64_t>(ts.tv_nsec);
+	}
+
+	static inline thread_local Running current_{nullptr, 0};
+
+	WorkStealingPool &pool_;
+	std::uint64_t burden_ns_;
+};
@@ -32,9 +32,22 @@ SOFTWARE.
 #include <new>
 #include <type_traits>
 #include <cstddef>
+#include <utility>
 
 
-template<typename T, size_t Capacity>
+// Shared by every structure built on the queue to keep contended fields on separate cache lines.
+#ifdef __cpp_lib_hardware_interference_size
+inline constexpr size_t kCacheLineSize = std::hardware_destructive_interference_size;
+#else
+inline constexpr size_t kCacheLineSize = 64;
+#endif
+
+// Which end the owner takes its own elements from. Lifo pops the newest (bottom_), which keeps
+// caches warm for divide-and-conquer work. Fifo takes the oldest (top_) with the same CAS as
+// steal(), which suits independent requests where LIFO order hurts tail latency.
+enum class OwnerOrder { Lifo, Fifo };
+
+template<typename T, size_t Capacity, OwnerOrder Order = OwnerOrder::Lifo>
 class WorkStealingQueue {
 	static_assert((Capacity & (Capacity - 1)) == 0,
 	              "Capacity must be power of two");
@@ -106,6 +119,8 @@ public:
 	                                std::is_nothrow_destructible_v<T>) {
 		static_assert(std::is_move_constructible_v<T>, "T must be move-constructible");
 		static_assert(std::is_destructible_v<T>, "T must be destructible");
+		if constexpr (Order == OwnerOrder::Fifo)
+			return pop_top();
 		// Decrement bottom_ to prevent thieves from initiating a steal().
 		const auto pop_idx = bottom_.load(std::memory_order_relaxed) - 1;
 		bottom_.store(pop_idx, std::memory_order_release);
@@ -167,15 +182,88 @@ public:
 		}
 	}
 
+	// Owner only. Pop up to max_items from the bottom while pred(element) holds, writing them to
+	// out in pop order. The first element that fails pred is pushed back where it was.
+	template<typename Pred, typename OutputIt>
+		requires (Order == OwnerOrder::Lifo)
+	size_t pop_batch_if(Pred &&pred, OutputIt out, size_t max_items) {
+		static_assert(std::is_invocable_r_v<bool, Pred &, const T &>,
+		              "Pred must be callable as bool(const T&)");
+		size_t n = 0;
+		while (n < max_items) {
+			auto item = pop();
+			if (!item) {
+				break;
+			}
+			if (!pred(std::as_const(*item))) {
+				// The slot was just freed by pop(), so this cannot fail.
+				[[maybe_unused]] const bool pushed = try_emplace(std::move(*item));
+				assert(pushed);
+				break;
+			}
+			*out++ = std::move(*item);
+			++n;
+		}
+		return n;
+	}
+
+	// Steal the top element only if pred(element) holds. The predicate sees the thief's
+	// snapshot of the slot and the element is only claimed on a successful CAS of top_.
+	template<typename Pred>
+	[[nodiscard]]
+	std::optional<T> steal_if(Pred &&pred) noexcept(std::is_nothrow_move_constructible_v<T> &&
+	                                                std::is_nothrow_destructible_v<T> &&
+	                                                std::is_nothrow_invocable_v<Pred &, const T &>) {
+		static_assert(std::is_move_constructible_v<T>,
+		              "T must be move-constructible");
+		static_assert(std::is_copy_assignable_v<T>,
+		              "T must be copy-assignable");
+		static_assert(std::is_invocable_r_v<bool, Pred &, const T &>,
+		              "Pred must be callable as bool(const T&)");
+
+		auto steal_idx = top_.load(std::memory_order_acquire);
+		const auto bottom = bottom_.load(std::memory_order_acquire);
+
+		if (steal_idx >= bottom) {
+			return std::nullopt;
+		}
+		auto out = buffer_[steal_idx & kMask];
+		if (!pred(std::as_const(out))) {
+			// Leave the element for a thief (or the owner) that can run it.
+			return std::nullopt;
+		}
+
+		if (top_.compare_exchange_strong(steal_idx, steal_idx + 1, std::memory_order_seq_cst,
+		                                 std::memory_order_relaxed)) {
+			if constexpr (!std::is_trivially_destructible_v<T>)
+				buffer_[steal_idx & kMask].~T();
+			return out;
+		} else {
+			return std::nullopt;
+		}
+	}
+
 private:
-#ifdef __cpp_lib_hardware_interference_size
-	static constexpr size_t kCacheLineSize =
-			std::hardware_destructive_interference_size;
+	// Fifo owner pop: the steal() protocol, but the owner is the only writer of bottom_ and of the
+	// slots, so it can read bottom_ relaxed and move the element out after winning the CAS
+	// instead of copying it before.
+	std::optional<T> pop_top() noexcept(std::is_nothrow_move_constructible_v<T> &&
+	                                    std::is_nothrow_destructible_v<T>) {
+		auto top = top_.load(std::memory_order_acquire);
+		const auto bottom = bottom_.load(std::memory_order_relaxed);
+		while (top < bottom) {
+			if (top_.compare_exchange_weak(top, top + 1, std::memory_order_seq_cst,
+			                               std::memory_order_acquire)) {
+				auto out = std::move(buffer_[top & kMask]);
+				if constexpr (!std::is_trivially_destructible_v<T>)
+					buffer_[top & kMask].~T();
+				return out;
+			}
+		}
+		return std::nullopt;
+	}
+
 	static constexpr size_t kMask = Capacity - 1;
-#else
-  static constexpr size_t kCacheLineSize = 64;
-  static constexpr size_t kMask = Capacity - 1;
-#endif
 	// Start buffer on new cache line to avoid false sharing with previous elements in memory
 	std::allocator<T> allocator_ [[no_unique_address]];
 	T *buffer_;
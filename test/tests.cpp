@@ -3,6 +3,22 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 #include "wsq.h"
+#include "weighted_wsq.h"
+#include "range_wsq.h"
+#include "blocked_range.h"
+#include "pool.h"
+#include "shm_wsq.h"
+#include "net_wsq.h"
+#include "scheduler_sim.h"
+#include "work_span.h"
+#include "task_profile.h"
+#include "auto_tuner.h"
+#include "topology.h"
+#include "task_arena.h"
+#include "strand.h"
+#include "future.h"
+#include "runtime.h"
+#include "schedule_replay.h"
 #include <thread>
 
 #include <atomic>
@@ -11,6 +27,19 @@
 #include <array>
 #include <deque>
 #include <set>
+#include <map>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 
 namespace {
@@ -164,6 +193,1455 @@ TEST_CASE("pop and steal, [wsq]") {
 }
 
 
+TEST_CASE("fifo owner order, [wsq]") {
+    WorkStealingQueue<int, 64, OwnerOrder::Fifo> deque;
+    for (int i = 0; i < 5; ++i)
+        deque.emplace(i);
+    REQUIRE(deque.pop() == 0);
+    REQUIRE(deque.steal() == 1);
+    REQUIRE(deque.pop() == 2);
+    REQUIRE(deque.size() == 2);
+
+    // Non-trivially-copyable elements are moved out by the owner.
+    WorkStealingQueue<std::string, 8, OwnerOrder::Fifo> strings;
+    strings.emplace("first");
+    strings.emplace("second");
+    REQUIRE(strings.pop() == "first");
+    REQUIRE(strings.pop() == "second");
+    REQUIRE(!strings.pop());
+}
+
+TEST_CASE("fifo owner pop against steals, [wsq]") {
+    WorkStealingQueue<int, 1 << 12, OwnerOrder::Fifo> deque;
+    constexpr int kItems = 100000;
+    std::atomic<int> taken{0};
+    std::atomic<long long> sum{0};
+    std::vector<std::thread> thieves;
+    for (int t = 0; t < 3; ++t) {
+        thieves.emplace_back([&] {
+            while (taken.load() < kItems) {
+                if (auto x = deque.steal()) {
+                    sum.fetch_add(*x);
+                    taken.fetch_add(1);
+                }
+            }
+        });
+    }
+    // The owner's own pops come out in push order.
+    int last = -1;
+    bool ordered = true;
+    for (int i = 0; i < kItems; ++i) {
+        deque.emplace(i);
+        if (i % 2 == 0) {
+            if (auto x = deque.pop()) {
+                ordered = ordered && *x > last;
+                last = *x;
+                sum.fetch_add(*x);
+                taken.fetch_add(1);
+            }
+        }
+    }
+    while (taken.load() < kItems) {
+        if (auto x = deque.pop()) {
+            ordered = ordered && *x > last;
+            last = *x;
+            sum.fetch_add(*x);
+            taken.fetch_add(1);
+        }
+    }
+    for (auto &t: thieves)
+        t.join();
+    REQUIRE(ordered);
+    REQUIRE(sum.load() == static_cast<long long>(kItems) * (kItems - 1) / 2);
+}
+
+TEST_CASE("steal_if, [wsq]") {
+    auto deque = example_wsq();
+    auto is_even = [](const int& x) { return x % 2 == 0; };
+
+    // Empty deque.
+    REQUIRE(!deque.steal_if(is_even));
+
+    // Predicate rejects the top element: nothing is claimed.
+    deque.emplace(1);
+    deque.emplace(2);
+    REQUIRE(!deque.steal_if(is_even));
+    REQUIRE(deque.size() == 2);
+
+    // Another thief without the restriction takes the top, exposing an even element.
+    auto s = deque.steal();
+    REQUIRE((s && *s == 1));
+    auto e = deque.steal_if(is_even);
+    REQUIRE((e && *e == 2));
+    REQUIRE(deque.empty());
+}
+
+TEST_CASE("steal_if against pop, [wsq]") {
+    auto deque = example_wsq();
+    const int max_items = 100000;
+    const int nthreads = 4;
+
+    std::atomic<int> even_seen{0};
+    std::atomic<int> odd_seen{0};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+
+    for (int i = 0; i < nthreads; ++i) {
+        threads.emplace_back([&deque, &even_seen, &done]() {
+            while (!done.load(std::memory_order_seq_cst) || !deque.empty()) {
+                auto x = deque.steal_if([](const int& v) { return v % 2 == 0; });
+                if (x) {
+                    assert(*x % 2 == 0);
+                    even_seen.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < max_items; ++i) {
+        deque.emplace(i);
+        if (i % 8 == 7) {
+            // Owner drains whatever the restricted thieves leave behind.
+            while (auto x = deque.pop()) {
+                (*x % 2 == 0 ? even_seen : odd_seen).fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+    done.store(true, std::memory_order_seq_cst);
+    for (auto& t : threads) t.join();
+
+    REQUIRE(even_seen.load() == max_items / 2);
+    REQUIRE(odd_seen.load() == max_items / 2);
+}
+
+
+namespace {
+    struct costed_task {
+        int id;
+        size_t cost;
+    };
+    struct task_cost {
+        size_t operator()(const costed_task& t) const noexcept { return t.cost; }
+    };
+    using weighted_wsq = WeightedWorkStealingQueue<costed_task, (1 << 12), task_cost>;
+}
+
+TEST_CASE("pop_batch_if, [wsq]") {
+    auto deque = example_wsq();
+    for (int i : {1, 3, 2, 4, 6, 8})
+        deque.emplace(i);
+
+    // Takes same-kind elements from the bottom, newest first, and stops at the first mismatch.
+    std::vector<int> batch;
+    auto is_even = [](const int& x) { return x % 2 == 0; };
+    REQUIRE(deque.pop_batch_if(is_even, std::back_inserter(batch), 2) == 2);
+    REQUIRE(batch == std::vector<int>{8, 6});
+    REQUIRE(deque.pop_batch_if(is_even, std::back_inserter(batch), 10) == 2);
+    REQUIRE(batch == std::vector<int>{8, 6, 4, 2});
+
+    // The mismatching element stays in place.
+    REQUIRE(deque.pop_batch_if(is_even, std::back_inserter(batch), 10) == 0);
+    REQUIRE(deque.size() == 2);
+    auto p = deque.pop();
+    REQUIRE((p && *p == 3));
+    auto s = deque.steal();
+    REQUIRE((s && *s == 1));
+    REQUIRE(deque.pop_batch_if(is_even, std::back_inserter(batch), 10) == 0);
+}
+
+TEST_CASE("weighted steal_half, [wsq]") {
+    weighted_wsq deque;
+    REQUIRE(deque.weight() == 0);
+
+    // One expensive task at the top followed by many cheap ones.
+    deque.emplace(costed_task{0, 1000});
+    for (int i = 1; i <= 100; ++i)
+        deque.emplace(costed_task{i, 10});
+    REQUIRE(deque.weight() == 2000);
+
+    // Half the weight is the single expensive task, not half the items.
+    std::vector<costed_task> loot;
+    REQUIRE(deque.steal_half(std::back_inserter(loot)) == 1000);
+    REQUIRE(loot.size() == 1);
+    REQUIRE(loot[0].id == 0);
+    REQUIRE(deque.weight() == 1000);
+
+    loot.clear();
+    REQUIRE(deque.steal_half(std::back_inserter(loot)) == 500);
+    REQUIRE(loot.size() == 50);
+    REQUIRE(deque.weight() == 500);
+
+    auto p = deque.pop();
+    REQUIRE((p && p->id == 100));
+    REQUIRE(deque.weight() == 490);
+}
+
+TEST_CASE("heaviest_victim, [wsq]") {
+    std::array<weighted_wsq, 3> deques;
+    REQUIRE(heaviest_victim(deques) == deques.end());
+
+    deques[0].emplace(costed_task{0, 5});
+    deques[0].emplace(costed_task{1, 5});
+    deques[2].emplace(costed_task{2, 50});
+    REQUIRE(heaviest_victim(deques) == deques.begin() + 2);
+
+    std::vector<weighted_wsq*> victims{&deques[0], &deques[1]};
+    REQUIRE(*heaviest_victim(victims) == &deques[0]);
+}
+
+TEST_CASE("weighted steal_half against pop, [wsq]") {
+    weighted_wsq deque;
+    const int max_items = 100000;
+    const int nthreads = 4;
+
+    std::atomic<long long> remaining{0};
+    for (int i = 0; i < max_items; ++i)
+        remaining += 1 + i % 7;
+    const auto total = remaining.load();
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads);
+    for (int i = 0; i < nthreads; ++i) {
+        threads.emplace_back([&]() {
+            std::vector<costed_task> loot;
+            while (!done.load(std::memory_order_seq_cst) || !deque.empty()) {
+                loot.clear();
+                const auto w = deque.steal_half(std::back_inserter(loot));
+                remaining.fetch_sub(static_cast<long long>(w), std::memory_order_relaxed);
+            }
+        });
+    }
+
+    for (int i = 0; i < max_items; ++i) {
+        deque.emplace(costed_task{i, static_cast<size_t>(1 + i % 7)});
+        if (i % 4 == 3) {
+            if (auto x = deque.pop())
+                remaining.fetch_sub(static_cast<long long>(x->cost), std::memory_order_relaxed);
+        }
+    }
+    done.store(true, std::memory_order_seq_cst);
+    for (auto& t : threads) t.join();
+
+    REQUIRE(total > 0);
+    REQUIRE(remaining.load() == 0);
+    REQUIRE(deque.weight() == 0);
+}
+
+
+TEST_CASE("range deque basic operations, [range_wsq]") {
+    RangeWorkStealingQueue<16> deque;
+    REQUIRE(!deque.pop());
+    REQUIRE(!deque.steal());
+
+    // A whole loop occupies one slot.
+    deque.push({0, 100});
+    REQUIRE(deque.size() == 1);
+
+    // Thief splits the range and takes the upper half.
+    auto s = deque.steal();
+    REQUIRE((s && *s == IndexRange{50, 100}));
+    REQUIRE(deque.size() == 1);
+
+    // Owner consumes grain-sized chunks from the lower end.
+    auto p = deque.pop(16);
+    REQUIRE((p && *p == IndexRange{0, 16}));
+    p = deque.pop(16);
+    REQUIRE((p && *p == IndexRange{16, 32}));
+
+    s = deque.steal();
+    REQUIRE((s && *s == IndexRange{41, 50}));
+    p = deque.pop();
+    REQUIRE((p && *p == IndexRange{32, 41}));
+
+    // Drained slot is retired lazily.
+    REQUIRE(!deque.pop());
+    REQUIRE(deque.empty());
+
+    // Single-index ranges are stolen whole.
+    deque.push({7, 8});
+    s = deque.steal();
+    REQUIRE((s && *s == IndexRange{7, 8}));
+    REQUIRE(!deque.steal());
+    REQUIRE(deque.empty());
+
+    // Newest range is consumed first by the owner, oldest split by thieves.
+    deque.push({0, 10});
+    deque.push({100, 110});
+    p = deque.pop(4);
+    REQUIRE((p && *p == IndexRange{100, 104}));
+    s = deque.steal();
+    REQUIRE((s && *s == IndexRange{5, 10}));
+}
+
+TEST_CASE("range deque owner against thieves, [range_wsq]") {
+    constexpr std::uint32_t n = 1 << 20;
+    constexpr std::uint32_t grain = 64;
+    const int nthieves = 4;
+
+    RangeWorkStealingQueue<1 << 8> owner;
+    std::vector<std::atomic<int>> visits(n);
+    std::atomic<std::uint32_t> remaining{n};
+
+    auto run = [&](IndexRange r) {
+        for (auto i = r.begin; i < r.end; ++i)
+            visits[i].fetch_add(1, std::memory_order_relaxed);
+        remaining.fetch_sub(r.size(), std::memory_order_seq_cst);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(nthieves);
+    for (int t = 0; t < nthieves; ++t) {
+        threads.emplace_back([&]() {
+            while (remaining.load(std::memory_order_seq_cst) > 0) {
+                if (auto r = owner.steal()) {
+                    // Thieves process stolen halves in chunks too.
+                    RangeWorkStealingQueue<1 << 4> local;
+                    local.push(*r);
+                    while (auto c = local.pop(grain))
+                        run(*c);
+                }
+            }
+        });
+    }
+
+    owner.push({0, n});
+    while (auto c = owner.pop(grain))
+        run(*c);
+    for (auto& t : threads) t.join();
+
+    REQUIRE(remaining.load() == 0);
+    REQUIRE(std::ranges::all_of(visits, [](const auto& v) { return v.load() == 1; }));
+}
+
+
+TEST_CASE("blocked ranges, [pool]") {
+    // Split points of a float range fall on cache-line boundaries.
+    BlockedRange r(0, 1000, 1, cache_line_elements<float>());
+    REQUIRE(r.grain() == cache_line_elements<float>());
+    auto upper = r.split();
+    REQUIRE(r.end() == upper.begin());
+    REQUIRE(upper.begin() % cache_line_elements<float>() == 0);
+    REQUIRE(upper.end() == 1000);
+
+    // 2D ranges split along the longest dimension.
+    BlockedRange2d<float> wide(0, 4, 0, 4096);
+    auto right = wide.split();
+    REQUIRE(wide.rows().size() == 4);
+    REQUIRE(right.rows().size() == 4);
+    REQUIRE(right.cols().begin() == 2048);
+
+    BlockedRange2d<float> tall(0, 4096, 0, 64);
+    auto bottom = tall.split();
+    REQUIRE(bottom.rows().begin() == 2048);
+    REQUIRE(bottom.cols().size() == 64);
+
+    BlockedRange3d<double> cube(0, 8, 0, 8, 0, 512);
+    auto back = cube.split();
+    REQUIRE(back.cols().begin() == 256);
+    REQUIRE(back.pages().size() == 8);
+
+    // With a phase, split points land where (index + phase) is a whole line.
+    const size_t line = cache_line_elements<float>();
+    BlockedRange shifted(0, 1000, 1, line, 3);
+    auto shifted_upper = shifted.split();
+    REQUIRE((shifted_upper.begin() + 3) % line == 0);
+    REQUIRE(shifted_upper.end() == 1000);
+}
+
+TEST_CASE("parallel_for covers every index once, [pool]") {
+    WorkStealingPool pool(4);
+    const size_t n = 100000;
+    std::vector<std::atomic<int>> visits(n);
+
+    pool.parallel_for(0, n, 64, [&](size_t i) {
+        visits[i].fetch_add(1, std::memory_order_relaxed);
+    });
+    REQUIRE(std::ranges::all_of(visits, [](const auto& v) { return v.load() == 1; }));
+
+    // 2D leaves tile the iteration space and never split inside a cache line of the grid, even
+    // when the grid starts mid-line.
+    const size_t rows = 123, cols = 1024;
+    const size_t line = cache_line_elements<float>();
+    std::vector<float> storage(rows * cols + line);
+    const size_t skew = (line / 2 + line - cache_line_offset(storage.data())) % line;
+    float* grid = storage.data() + skew;
+    REQUIRE(cache_line_offset(grid) != 0);
+    std::vector<std::atomic<int>> cells(rows * cols);
+    std::atomic<bool> aligned{true};
+    pool.parallel_for(BlockedRange2d<float>(grid, cols, 0, rows, 1, 0, cols), [&](const BlockedRange2d<float>& r) {
+        for (auto i = r.rows().begin(); i != r.rows().end(); ++i) {
+            // Interior leaf edges must sit on line boundaries of the actual rows.
+            if (r.cols().begin() != 0 && cache_line_offset(&grid[i * cols + r.cols().begin()]) != 0)
+                aligned = false;
+            if (r.cols().end() != cols && cache_line_offset(&grid[i * cols + r.cols().end()]) != 0)
+                aligned = false;
+            for (auto j = r.cols().begin(); j != r.cols().end(); ++j)
+                cells[i * cols + j].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    REQUIRE(aligned.load());
+    REQUIRE(std::ranges::all_of(cells, [](const auto& v) { return v.load() == 1; }));
+}
+
+TEST_CASE("cache-line aligned parallel_for over a span, [pool]") {
+    alignas(kCacheLineSize) static std::array<float, 4096> buffer{};
+    REQUIRE(cache_line_offset(buffer.data()) == 0);
+    REQUIRE(cache_line_offset(buffer.data() + 3) == 3);
+    REQUIRE(cache_line_offset(buffer.data() + cache_line_elements<float>()) == 0);
+
+    // A span that starts mid-line still gets every index exactly once.
+    WorkStealingPool pool(4);
+    std::span<float> data(buffer.data() + 3, buffer.size() - 5);
+    pool.parallel_for(data, 1, [&](size_t i) { data[i] += 1.0f; });
+    REQUIRE(std::ranges::all_of(data, [](float v) { return v == 1.0f; }));
+    REQUIRE(buffer[0] == 0.0f);
+    REQUIRE(buffer.back() == 0.0f);
+}
+
+namespace {
+    struct scored_item {
+        int value;
+        int score;
+    };
+    std::atomic<size_t> batch_items_left{0};
+    std::atomic<size_t> largest_batch{0};
+
+    void score_batch(std::span<scored_item* const> items) {
+        for (auto* item : items)
+            item->score = item->value * 2;
+        size_t largest = largest_batch.load();
+        while (items.size() > largest && !largest_batch.compare_exchange_weak(largest, items.size())) {
+        }
+        batch_items_left.fetch_sub(items.size(), std::memory_order_acq_rel);
+    }
+    using score_task = BatchTask<scored_item, &score_batch, 16>;
+}
+
+TEST_CASE("batched same-kind tasks, [pool]") {
+    WorkStealingPool pool(1);
+    std::vector<scored_item> items(1000);
+    for (int i = 0; i < 1000; ++i)
+        items[i] = {i, -1};
+
+    batch_items_left = items.size();
+    largest_batch = 0;
+    // Queue the items from a worker so they land on its local deque.
+    pool.submit([&] {
+        for (auto& item : items)
+            pool.submit(score_task::make(&item));
+    });
+    // Don't help from this thread: it would take the root task and queue the items externally.
+    while (batch_items_left.load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+
+    REQUIRE(std::ranges::all_of(items, [](const auto& item) { return item.score == item.value * 2; }));
+    REQUIRE(largest_batch.load() > 1);
+    REQUIRE(largest_batch.load() <= 16);
+}
+
+TEST_CASE("nested parallel_for and submit, [pool]") {
+    WorkStealingPool pool(3);
+    std::atomic<size_t> sum{0};
+
+    pool.parallel_for(0, 64, 1, [&](size_t i) {
+        pool.parallel_for(0, 100, 8, [&](size_t j) {
+            sum.fetch_add(i * 100 + j, std::memory_order_relaxed);
+        });
+    });
+    REQUIRE(sum.load() == (6400 * 6399) / 2);
+
+    std::atomic<size_t> pending{10};
+    for (int i = 0; i < 10; ++i)
+        pool.submit([&] { pending.fetch_sub(1, std::memory_order_acq_rel); });
+    pool.wait(pending);
+    REQUIRE(pending.load() == 0);
+}
+
+
+TEST_CASE("shared queue open times out on an unfinished set, [shm_wsq]") {
+    using shared_wsq = SharedWorkStealingQueue<long long, (1 << 10)>;
+    const std::string name = "/wsq_test_abandoned_" + std::to_string(::getpid());
+    // A creator that died before sizing the object, then before publishing the header.
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    REQUIRE(fd != -1);
+    auto timed_out = [&] {
+        try {
+            (void) SharedQueueSet<shared_wsq>::open(name, std::chrono::milliseconds(20));
+        } catch (const std::system_error& e) {
+            return e.code() == std::errc::timed_out;
+        }
+        return false;
+    };
+    REQUIRE(timed_out());
+    REQUIRE(::ftruncate(fd, 1 << 20) == 0);
+    REQUIRE(timed_out());
+    ::close(fd);
+    ::shm_unlink(name.c_str());
+}
+
+TEST_CASE("shared queue across processes, [shm_wsq]") {
+    using shared_wsq = SharedWorkStealingQueue<long long, (1 << 10)>;
+    const std::string name = "/wsq_test_" + std::to_string(::getpid());
+    auto queues = SharedQueueSet<shared_wsq>::create(name, 2);
+    REQUIRE(queues.size() == 2);
+
+    const long long max_items = 100000;
+    const pid_t child = ::fork();
+    REQUIRE(child != -1);
+    if (child == 0) {
+        // Thief process: steal from queue 0 until the sentinel, report the sum on queue 1.
+        auto shared = SharedQueueSet<shared_wsq>::open(name);
+        long long sum = 0;
+        while (true) {
+            if (auto x = shared[0].steal()) {
+                if (*x < 0) break;
+                sum += *x;
+            }
+        }
+        shared[1].emplace(sum);
+        ::_exit(0);
+    }
+
+    long long sum = 0;
+    for (long long i = 1; i <= max_items; ++i) {
+        queues[0].emplace(i);
+        if (i % 3 == 0) {
+            if (auto x = queues[0].pop()) sum += *x;
+        }
+    }
+    while (!queues[0].empty()) {
+        if (auto x = queues[0].pop()) sum += *x;
+    }
+    queues[0].emplace(-1);
+
+    int status = 0;
+    REQUIRE(::waitpid(child, &status, 0) == child);
+    REQUIRE((WIFEXITED(status) && WEXITSTATUS(status) == 0));
+    auto child_sum = queues[1].pop();
+    REQUIRE(child_sum.has_value());
+    REQUIRE(sum + *child_sum == max_items * (max_items + 1) / 2);
+}
+
+
+TEST_CASE("network stealing between processes on localhost, [net_wsq]") {
+    using node_type = NetworkStealingNode<std::uint32_t, (1 << 16)>;
+    const int nnodes = 3;
+    const std::uint32_t depth = 10;
+
+    // Bind every node's port up front so all processes know the endpoints.
+    std::vector<NodeListener> listeners;
+    std::vector<NodeEndpoint> endpoints;
+    for (int i = 0; i < nnodes; ++i) {
+        listeners.push_back(NodeListener::bind_loopback());
+        endpoints.push_back({"127.0.0.1", listeners.back().port});
+    }
+
+    // Per node: a pipe reporting its executed count and a pipe releasing it once all are done.
+    std::vector<std::array<int, 2>> results(nnodes), releases(nnodes);
+    for (int n = 0; n < nnodes; ++n) {
+        REQUIRE(::pipe(results[n].data()) == 0);
+        REQUIRE(::pipe(releases[n].data()) == 0);
+    }
+
+    std::vector<pid_t> children;
+    for (int n = 0; n < nnodes; ++n) {
+        const pid_t pid = ::fork();
+        REQUIRE(pid != -1);
+        if (pid == 0) {
+            for (int i = 0; i < nnodes; ++i) {
+                ::close(results[i][0]);
+                ::close(releases[i][1]);
+                if (i != n) {
+                    ::close(listeners[i].fd);
+                    ::close(results[i][1]);
+                    ::close(releases[i][0]);
+                }
+            }
+
+            // Each task is a node of a binary tree; node 0 starts with the root.
+            std::uint64_t executed = 0;
+            {
+                node_type node(listeners[n]);
+                if (n == 0) {
+                    node.set_idle(false);
+                    node.queue().emplace(depth);
+                }
+                std::minstd_rand rng(n + 1);
+                auto backoff = std::chrono::microseconds(50);
+                while (true) {
+                    if (auto task = node.queue().pop()) {
+                        // Enough work per task that peers get a chance to steal.
+                        const auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(50);
+                        while (std::chrono::steady_clock::now() < until) {
+                        }
+                        ++executed;
+                        if (*task > 0) {
+                            node.queue().emplace(*task - 1);
+                            node.queue().emplace(*task - 1);
+                        }
+                        continue;
+                    }
+                    node.set_idle(true);
+                    const auto victim = (n + 1 + rng() % (nnodes - 1)) % nnodes;
+                    if (node.steal_from(endpoints[victim]) > 0) {
+                        backoff = std::chrono::microseconds(50);
+                        continue;
+                    }
+                    if (node_type::terminated(endpoints))
+                        break;
+                    std::this_thread::sleep_for(backoff);
+                    backoff = std::min(backoff * 2, std::chrono::microseconds(5000));
+                }
+                // Keep answering status requests until every peer has seen termination too.
+                const bool reported = ::write(results[n][1], &executed, sizeof(executed)) == sizeof(executed);
+                char eof;
+                while (::read(releases[n][0], &eof, 1) > 0) {
+                }
+                if (!reported) ::_exit(1);
+            }
+            ::_exit(0);
+        }
+        children.push_back(pid);
+    }
+    for (int n = 0; n < nnodes; ++n) {
+        ::close(listeners[n].fd);
+        ::close(results[n][1]);
+        ::close(releases[n][0]);
+    }
+
+    std::uint64_t total = 0;
+    for (int n = 0; n < nnodes; ++n) {
+        std::uint64_t executed = 0;
+        REQUIRE(::read(results[n][0], &executed, sizeof(executed)) == sizeof(executed));
+        total += executed;
+        ::close(results[n][0]);
+    }
+    for (int n = 0; n < nnodes; ++n)
+        ::close(releases[n][1]);
+    for (pid_t pid : children) {
+        int status = 0;
+        REQUIRE(::waitpid(pid, &status, 0) == pid);
+        REQUIRE((WIFEXITED(status) && WEXITSTATUS(status) == 0));
+    }
+    REQUIRE(total == (1u << (depth + 1)) - 1);
+}
+
+
+namespace {
+    // Plain blocking loopback connection, for tests that play a misbehaving peer.
+    int connect_loopback(std::uint16_t port) {
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        REQUIRE(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        return fd;
+    }
+}
+
+TEST_CASE("network steal without ack returns the items, [net_wsq]") {
+    using node_type = NetworkStealingNode<std::uint32_t, (1 << 10)>;
+    auto listener = NodeListener::bind_loopback();
+    const NodeEndpoint self{"127.0.0.1", listener.port};
+    node_type node(listener, std::chrono::milliseconds(200));
+    for (std::uint32_t i = 0; i < 10; ++i)
+        node.queue().emplace(i);
+    node.set_idle(true);
+
+    // A thief that takes the batch and hangs up without acknowledging it.
+    const int fd = connect_loopback(listener.port);
+    std::uint32_t count = 0;
+    REQUIRE(::send(fd, "S", 1, 0) == 1);
+    REQUIRE(::recv(fd, &count, sizeof(count), MSG_WAITALL) == sizeof(count));
+    REQUIRE(count == 5);
+    std::vector<std::uint32_t> items(count);
+    REQUIRE(::recv(fd, items.data(), count * sizeof(std::uint32_t), MSG_WAITALL) ==
+            static_cast<ssize_t>(count * sizeof(std::uint32_t)));
+    ::close(fd);
+
+    // Served after the failed steal: the batch is uncounted and the node is not idle.
+    const auto status = node_type::query_status(self);
+    REQUIRE(status.has_value());
+    REQUIRE(status->sent == 0);
+    REQUIRE(status->idle == 0);
+    REQUIRE(node.queue().size() == 5);
+
+    // The owner takes the batch back before contacting any victim.
+    REQUIRE(node.steal_from(NodeEndpoint{"127.0.0.1", 1}) == 5);
+    REQUIRE(node.queue().size() == 10);
+    std::set<std::uint32_t> left;
+    while (auto x = node.queue().pop())
+        left.insert(*x);
+    REQUIRE(left.size() == 10);
+}
+
+TEST_CASE("network node times out hung peers, [net_wsq]") {
+    using node_type = NetworkStealingNode<std::uint32_t, (1 << 10)>;
+    const auto timeout = std::chrono::milliseconds(100);
+
+    // A victim that accepts connections (in the kernel backlog) but never answers.
+    auto silent = NodeListener::bind_loopback();
+    auto listener = NodeListener::bind_loopback();
+    const NodeEndpoint self{"127.0.0.1", listener.port};
+    node_type node(listener, timeout);
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(node.steal_from(NodeEndpoint{"127.0.0.1", silent.port}) == 0);
+    REQUIRE(std::chrono::steady_clock::now() - start < 20 * timeout);
+    REQUIRE(!node_type::query_status(NodeEndpoint{"127.0.0.1", silent.port}, timeout).has_value());
+
+    // A peer that connects and never sends its request only holds the server up for a timeout.
+    const int hung = connect_loopback(listener.port);
+    start = std::chrono::steady_clock::now();
+    const auto status = node_type::query_status(self, std::chrono::seconds(5));
+    REQUIRE(status.has_value());
+    REQUIRE(std::chrono::steady_clock::now() - start < 20 * timeout);
+    ::close(hung);
+    ::close(silent.fd);
+}
+
+TEST_CASE("scheduler simulator, [scheduler_sim]") {
+    // Root spawns 64 independent leaves of 1000ns each.
+    TaskDag dag;
+    dag.nodes.push_back({-1, 100, 0});
+    for (int i = 0; i < 64; ++i)
+        dag.nodes.push_back({0, 1000, static_cast<std::uint64_t>(i)});
+
+    std::stringstream text;
+    dag.save(text);
+    const auto loaded = TaskDag::load(text);
+    REQUIRE(loaded.nodes.size() == dag.nodes.size());
+    REQUIRE(loaded.nodes[5].spawn_offset_ns == 4);
+
+    SchedulerSimulator sim(loaded, QueueOpCosts{10, 10, 50});
+    const auto serial = sim.run({1, VictimPolicy::Random, 1, 1024});
+    REQUIRE(serial.tasks == 65);
+    REQUIRE(serial.steals == 0);
+    REQUIRE(serial.total_work_ns == 64100);
+    REQUIRE(serial.makespan_ns >= serial.total_work_ns);
+
+    const auto parallel = sim.run({4, VictimPolicy::Random, 1, 1024});
+    REQUIRE(parallel.steals > 0);
+    REQUIRE(parallel.makespan_ns < serial.makespan_ns);
+    REQUIRE(parallel.makespan_ns >= serial.total_work_ns / 4);
+
+    const auto batched = sim.run({4, VictimPolicy::MostLoaded, 8, 1024});
+    REQUIRE(batched.steals < parallel.steals);
+
+    // A tiny capacity forces children to run inline on the spawning worker.
+    const auto overflow = sim.run({4, VictimPolicy::RoundRobin, 1, 4});
+    REQUIRE(overflow.overflows > 0);
+}
+
+TEST_CASE("recording a task DAG from the pool, [scheduler_sim]") {
+    WorkStealingPool pool(2);
+    DagRecorder recorder;
+    std::atomic<size_t> pending{1 + 8 + 8 * 4};
+
+    recorder.spawn(pool, [&] {
+        for (int i = 0; i < 8; ++i) {
+            recorder.spawn(pool, [&] {
+                for (int j = 0; j < 4; ++j)
+                    recorder.spawn(pool, [&] { pending.fetch_sub(1, std::memory_order_acq_rel); });
+                pending.fetch_sub(1, std::memory_order_acq_rel);
+            });
+        }
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+    });
+    while (pending.load(std::memory_order_acquire) != 0)
+        std::this_thread::yield();
+
+    const auto dag = recorder.take();
+    REQUIRE(dag.nodes.size() == 41);
+    REQUIRE(dag.nodes[0].parent == -1);
+    REQUIRE(std::ranges::count(dag.nodes, 0, &TraceNode::parent) == 8);
+    for (size_t i = 1; i < dag.nodes.size(); ++i)
+        REQUIRE((dag.nodes[i].parent >= 0 && dag.nodes[i].parent < static_cast<std::int64_t>(i)));
+}
+
+
+namespace {
+    // CPU-bound busy work, so measured CPU time doesn't depend on preemption.
+    void burn(int iterations) {
+        volatile unsigned x = 0;
+        for (int i = 0; i < iterations; ++i)
+            x = x * 31 + i;
+    }
+}
+
+TEST_CASE("pool stats, [pool]") {
+    WorkStealingPool pool(2);
+    const auto before = pool.stats();
+    pool.set_timing(true);
+    // Run the region on a worker: an external waiter may otherwise run it all via injection.
+    std::atomic<size_t> pending{1};
+    pool.submit([&] {
+        pool.parallel_for(0, 4096, 16, [](size_t) {});
+        pending.fetch_sub(1);
+    });
+    while (pending.load() != 0)
+        std::this_thread::yield();
+    pool.set_timing(false);
+    const auto delta = pool.stats() - before;
+    REQUIRE(delta.emplaces > 0);
+    REQUIRE(delta.tasks_run > 0);
+    REQUIRE(delta.pops + delta.steals + delta.injected <= delta.tasks_run);
+}
+
+
+TEST_CASE("pool stats credit workers that are still idle, [pool]") {
+    // Workers that never find work go to sleep; their idle time must show without a wake-up.
+    WorkStealingPool pool(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto before = pool.stats();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const auto after = pool.stats();
+    REQUIRE(after.tasks_run == 0);
+    REQUIRE(after.idle_ns >= before.idle_ns);
+    REQUIRE((after - before).idle_ns >= 50'000'000);
+}
+
+TEST_CASE("work/span profiler, [work_span]") {
+    WorkStealingPool pool(2);
+    WorkSpanProfiler profiler(pool, 0);
+
+    // A chain of spawns has no parallelism.
+    std::function<void(int)> chain = [&](int n) {
+        burn(200000);
+        if (n > 0)
+            profiler.spawn([&chain, n] { chain(n - 1); });
+    };
+    const auto serial = profiler.measure("chain", [&] { chain(7); });
+    REQUIRE(serial.spawns == 7);
+    REQUIRE(serial.span_ns <= serial.work_ns);
+    REQUIRE(serial.parallelism() < 1.5);
+
+    // A fan-out of independent leaves has parallelism close to the number of leaves.
+    const auto wide = profiler.measure("fan-out", [&] {
+        profiler.parallel_for(BlockedRange(0, 32, 1), [](const BlockedRange&) {
+            burn(200000);
+        });
+    });
+    REQUIRE(wide.spawns >= 32);
+    REQUIRE(wide.parallelism() > 4.0);
+    REQUIRE(wide.burdened_span_ns == wide.span_ns);
+    REQUIRE(wide.speedup_bound(2) == 2.0);
+    REQUIRE(wide.burdened_speedup(1) <= 1.0);
+    REQUIRE(wide.scheduler.emplaces > 0);
+
+    WorkSpanProfiler burdened(pool, 10000);
+    const auto wide_burdened = burdened.measure("fan-out", [&] {
+        for (int i = 0; i < 8; ++i)
+            burdened.spawn([] { burn(50000); });
+    });
+    REQUIRE(wide_burdened.burdened_span_ns >= wide_burdened.span_ns + 10000);
+}
+
+
+TEST_CASE("log histogram, [task_profile]") {
+    LogHistogram a, b;
+    for (std::uint64_t ns = 1; ns <= 1000; ++ns)
+        a.record(ns);
+    b.record(1 << 20);
+    REQUIRE(a.count == 1000);
+    REQUIRE(a.max_ns == 1000);
+    REQUIRE(a.mean_ns() == 500.5);
+    REQUIRE(a.percentile_ns(0.5) >= 500);
+    REQUIRE(a.percentile_ns(0.5) < 1024);
+    REQUIRE(a.percentile_ns(1.0) == 1000);
+
+    a += b;
+    REQUIRE(a.count == 1001);
+    REQUIRE(a.max_ns == 1 << 20);
+    REQUIRE(a.buckets[LogHistogram::bucket_of(1 << 20)] == 1);
+    REQUIRE(a.percentile_ns(0.5) < 1024);
+}
+
+TEST_CASE("task type profiler, [task_profile]") {
+    enum : std::uint32_t { kHeavy, kLight, kTypes };
+    WorkStealingPool pool(2);
+    TaskTypeProfiler profiler(pool, kTypes);
+
+    constexpr size_t kPerType = 64;
+    std::atomic<size_t> pending{2 * kPerType};
+    for (size_t i = 0; i < kPerType; ++i) {
+        profiler.submit(kHeavy, [&] { burn(100000); pending.fetch_sub(1); });
+        profiler.submit(kLight, [&] { pending.fetch_sub(1); });
+    }
+    pool.wait(pending);
+
+    const auto profiles = profiler.snapshot();
+    REQUIRE(profiles.size() == kTypes);
+    REQUIRE(profiles[kHeavy].execution.count == kPerType);
+    REQUIRE(profiles[kLight].execution.count == kPerType);
+    REQUIRE(profiles[kLight].queueing.count == kPerType);
+    REQUIRE(profiles[kHeavy].execution.percentile_ns(0.5) > profiles[kLight].execution.percentile_ns(0.5));
+
+    std::ostringstream out;
+    const std::string names[] = {"heavy", "light"};
+    TaskTypeProfiler::print(out, profiles, names);
+    REQUIRE(out.str().find("heavy") != std::string::npos);
+}
+
+TEST_CASE("pool steal batch, [pool]") {
+    WorkStealingPool pool(3);
+    pool.set_steal_batch(0);
+    REQUIRE(pool.steal_batch() == 1);
+    pool.set_steal_batch(8);
+    REQUIRE(pool.steal_batch() == 8);
+
+    std::atomic<size_t> sum{0};
+    pool.parallel_for(0, 10000, 4, [&](size_t i) { sum.fetch_add(i, std::memory_order_relaxed); });
+    REQUIRE(sum.load() == 10000 * 9999 / 2);
+}
+
+TEST_CASE("auto tuner, [auto_tuner]") {
+    WorkStealingPool pool(2);
+    TunerBounds bounds;
+    bounds.min_grain = 16;
+    bounds.max_steal_batch = 4;
+    AutoTuner tuner(pool, bounds, 64);
+    REQUIRE(tuner.grain() == 64);
+    REQUIRE(tuner.queue_capacity() == WorkStealingPool::kQueueCapacity);
+
+    // Mostly idle workers with empty queues: the grain shrinks, but not below its bound.
+    for (int round = 0; round < 8; ++round) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        // Run the region on a worker so the pool's counters see it.
+        std::atomic<size_t> sum{0}, pending{1};
+        pool.submit([&] {
+            tuner.parallel_for(0, 256, [&](size_t i) { sum.fetch_add(i, std::memory_order_relaxed); });
+            pending.fetch_sub(1);
+        });
+        while (pending.load() != 0)
+            std::this_thread::yield();
+        REQUIRE(sum.load() == 256 * 255 / 2);
+        const auto sample = tuner.update();
+        REQUIRE(sample.idle_fraction >= 0.0);
+        REQUIRE(sample.idle_fraction <= 1.0);
+    }
+    REQUIRE(tuner.grain() < 64);
+    REQUIRE(tuner.grain() >= 16);
+    REQUIRE(tuner.steal_batch() >= 1);
+    REQUIRE(tuner.steal_batch() <= 4);
+
+    // Capacity follows the deepest queue observed.
+    constexpr size_t kQueued = 1000;
+    std::atomic<bool> pushed{false}, release{false};
+    std::atomic<size_t> pending{kQueued + 1};
+    pool.submit([&] {
+        for (size_t i = 0; i < kQueued; ++i) {
+            pool.submit([&] {
+                while (!release.load())
+                    std::this_thread::yield();
+                pending.fetch_sub(1);
+            });
+        }
+        pushed.store(true);
+        pending.fetch_sub(1);
+    });
+    while (!pushed.load())
+        std::this_thread::yield();
+    const auto sample = tuner.update();
+    release.store(true);
+    while (pending.load() != 0)
+        std::this_thread::yield();
+    REQUIRE(sample.peak_queue >= kQueued - 2);
+    REQUIRE(tuner.queue_capacity() == 2048);
+
+    tuner.start(std::chrono::milliseconds(1));
+    pool.parallel_for(0, 1000, 1, [](size_t) {});
+    tuner.stop();
+}
+
+TEST_CASE("cpu list parsing, [topology]") {
+    REQUIRE(parse_cpu_list("0-3,8,10-11\n") == std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+    REQUIRE(parse_cpu_list("5,1,1-2") == std::vector<int>{1, 2, 5});
+    REQUIRE(parse_cpu_list("").empty());
+    REQUIRE(parse_cpu_list("x,3").size() == 1);
+}
+
+TEST_CASE("topology from sysfs, [topology]") {
+    // 2 NUMA nodes x 1 LLC x 2 cores x 2 SMT threads; cpu i and i + 4 are siblings.
+    const auto root = std::filesystem::temp_directory_path() / ("wsq_sysfs_" + std::to_string(getpid()));
+    const auto write = [&](const std::filesystem::path &file, const std::string &text) {
+        std::filesystem::create_directories((root / file).parent_path());
+        std::ofstream(root / file) << text << "\n";
+    };
+    write("devices/system/cpu/online", "0-7");
+    write("devices/system/cpu/isolated", "7");
+    write("devices/system/node/node0/cpulist", "0-1,4-5");
+    write("devices/system/node/node1/cpulist", "2-3,6-7");
+    for (int cpu = 0; cpu < 8; ++cpu) {
+        const auto dir = "devices/system/cpu/cpu" + std::to_string(cpu);
+        const int core = cpu % 4;
+        write(dir + "/topology/physical_package_id", std::to_string(core / 2));
+        write(dir + "/topology/core_id", std::to_string(core % 2));
+        write(dir + "/cache/index0/type", "Instruction");
+        write(dir + "/cache/index0/level", "1");
+        write(dir + "/cache/index0/shared_cpu_list", std::to_string(core) + "," + std::to_string(core + 4));
+        write(dir + "/cache/index1/type", "Unified");
+        write(dir + "/cache/index1/level", "3");
+        write(dir + "/cache/index1/shared_cpu_list", core < 2 ? "0-1,4-5" : "2-3,6-7");
+    }
+    write("fs/cgroup/job/cpuset.cpus.effective", "0-6");
+    write("cgroup", "0::/job");
+
+    const auto topo = CpuTopology::load(root);
+    REQUIRE(topo.num_cpus() == 8);
+    REQUIRE(topo.num_cores() == 4);
+    REQUIRE(topo.num_llcs() == 2);
+    REQUIRE(topo.num_numa_nodes() == 2);
+    REQUIRE(topo.cpus()[4].core == topo.cpus()[0].core);
+    REQUIRE(topo.cpus()[4].smt == 1);
+
+    REQUIRE(topo.plan(4, Placement::Compact) == std::vector<int>{0, 4, 1, 5});
+    REQUIRE(topo.plan(4, Placement::CoresFirst) == std::vector<int>{0, 1, 2, 3});
+    REQUIRE(topo.plan(4, Placement::Scatter) == std::vector<int>{0, 2, 1, 3});
+    REQUIRE(topo.plan(10, Placement::CoresFirst)[8] == 0);
+
+    const auto restricted = CpuTopology::load(root, std::vector<int>{2, 3, 6});
+    REQUIRE(restricted.num_cpus() == 3);
+    REQUIRE(restricted.num_numa_nodes() == 1);
+    REQUIRE(restricted.plan(3, Placement::CoresFirst) == std::vector<int>{2, 3, 6});
+
+    // The cgroup cpuset and isolated CPUs are excluded on top of this process's affinity mask.
+    const auto allowed = CpuTopology::allowed_cpus(root, root / "cgroup");
+    REQUIRE(std::ranges::none_of(allowed, [](int cpu) { return cpu >= 6; }));
+
+    std::filesystem::remove_all(root);
+}
+
+TEST_CASE("pinned pool, [topology]") {
+    const auto topo = CpuTopology::discover();
+    REQUIRE(topo.num_cpus() >= 1);
+    const auto placement = topo.plan(2);
+    REQUIRE(placement.size() == 2);
+    for (const int cpu: placement)
+        REQUIRE(std::ranges::any_of(topo.cpus(), [cpu](const CpuInfo &c) { return c.cpu == cpu; }));
+    REQUIRE(!pin_current_thread(-1));
+
+    WorkStealingPool pool(placement);
+    REQUIRE(pool.num_workers() == 2);
+    std::atomic<size_t> sum{0};
+    pool.parallel_for(0, 1000, 10, [&](size_t i) { sum.fetch_add(i, std::memory_order_relaxed); });
+    REQUIRE(sum.load() == 1000 * 999 / 2);
+}
+
+TEST_CASE("task arena, [task_arena]") {
+    WorkStealingPool pool(4);
+    TaskArena arena(pool, 2);
+    REQUIRE(arena.max_concurrency() == 2);
+    REQUIRE(TaskArena::current() == nullptr);
+
+    // Never more than max_concurrency threads inside the arena at once.
+    std::atomic<size_t> inside{0}, peak{0}, sum{0};
+    arena.parallel_for(0, 2000, 1, [&](size_t i) {
+        REQUIRE(TaskArena::current() == &arena);
+        const auto now = inside.fetch_add(1) + 1;
+        auto seen = peak.load();
+        while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+        }
+        burn(1000);
+        sum.fetch_add(i, std::memory_order_relaxed);
+        inside.fetch_sub(1);
+    });
+    REQUIRE(sum.load() == 2000 * 1999 / 2);
+    REQUIRE(peak.load() >= 1);
+    REQUIRE(peak.load() <= 2);
+    REQUIRE(arena.active() == 0);
+
+    // Tasks submitted from outside are picked up by pool workers joining the arena.
+    std::atomic<size_t> pending{64};
+    for (int i = 0; i < 64; ++i)
+        arena.submit([&] { pending.fetch_sub(1); });
+    while (pending.load() != 0)
+        std::this_thread::yield();
+
+    // Threads blocked in the arena never run pool tasks, and pool tasks run outside any arena.
+    std::atomic<size_t> pool_pending{256};
+    std::atomic<bool> leaked{false};
+    for (int i = 0; i < 256; ++i) {
+        pool.submit([&] {
+            if (TaskArena::current() != nullptr)
+                leaked.store(true);
+            burn(1000);
+            pool_pending.fetch_sub(1);
+        });
+    }
+    arena.parallel_for(0, 256, 1, [&](size_t) { burn(1000); });
+    while (pool_pending.load() != 0)
+        std::this_thread::yield();
+    REQUIRE(!leaked.load());
+
+    // Nested arenas restore the outer one.
+    TaskArena inner(pool, 1);
+    arena.execute([&] {
+        inner.execute([&] { REQUIRE(TaskArena::current() == &inner); });
+        REQUIRE(TaskArena::current() == &arena);
+    });
+    REQUIRE(arena.execute([] { return 42; }) == 42);
+}
+
+TEST_CASE("strand, [strand]") {
+    WorkStealingPool pool(4);
+    constexpr size_t kStrands = 8;
+    constexpr size_t kProducers = 3;
+    constexpr size_t kPosts = 500;
+
+    struct Key {
+        explicit Key(WorkStealingPool &pool) : strand(pool) {}
+        Strand strand;
+        std::atomic<bool> busy{false};
+        std::array<size_t, kProducers> next{};  // only touched from the strand
+        bool overlapped = false;
+        bool out_of_order = false;
+    };
+    std::deque<Key> keys;
+    for (size_t k = 0; k < kStrands; ++k)
+        keys.emplace_back(pool);
+
+    std::atomic<size_t> done{0};
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&, p] {
+            for (size_t i = 0; i < kPosts; ++i) {
+                auto &key = keys[(i + p) % kStrands];
+                key.strand.post([&key, &done, p, i] {
+                    if (key.busy.exchange(true))
+                        key.overlapped = true;
+                    // Posts of one producer to one strand arrive in post order.
+                    if (i < key.next[p])
+                        key.out_of_order = true;
+                    key.next[p] = i;
+                    key.busy.store(false);
+                    done.fetch_add(1);
+                });
+            }
+        });
+    }
+    for (auto &t: producers)
+        t.join();
+    while (done.load() != kProducers * kPosts)
+        std::this_thread::yield();
+    for (auto &key: keys) {
+        while (key.strand.pending() != 0)
+            std::this_thread::yield();
+        REQUIRE(!key.overlapped);
+        REQUIRE(!key.out_of_order);
+    }
+
+    // A strand task can post to its own strand; the new task runs after it.
+    Strand strand(pool);
+    std::vector<int> order;
+    std::atomic<bool> finished{false};
+    strand.post([&] {
+        strand.post([&] {
+            order.push_back(2);
+            finished.store(true);
+        });
+        order.push_back(1);
+    });
+    while (!finished.load())
+        std::this_thread::yield();
+    while (strand.pending() != 0)
+        std::this_thread::yield();
+    REQUIRE(order == std::vector<int>{1, 2});
+}
+
+
+TEST_CASE("busy strand yields to other local work, [strand]") {
+    WorkStealingPool pool(1);
+    Strand strand(pool);
+    std::atomic<size_t> ran{0};
+    std::atomic<size_t> seen_by_other{0};
+    std::atomic<bool> done{false};
+
+    // On the worker: queue another task, then a long strand run above it on the same deque.
+    pool.submit([&] {
+        pool.submit([&] { seen_by_other = ran.load(); });
+        for (int i = 0; i < 200; ++i)
+            strand.post([&] { ran.fetch_add(1); });
+        done = true;
+    });
+    while (!done.load() || strand.pending() != 0)
+        std::this_thread::yield();
+    // The other task runs once the strand has used up its first stint, not after all of it.
+    REQUIRE(seen_by_other.load() == 64);
+    REQUIRE(ran.load() == 200);
+}
+
+TEST_CASE("future then, [future]") {
+    WorkStealingPool pool(2);
+
+    auto f = async(pool, [] { return 20; })
+            .then([](int x) { return x + 1; })
+            .then([](int x) { return std::to_string(2 * x); });
+    REQUIRE(f.get() == "42");
+    REQUIRE(!f.valid());
+
+    // A continuation attached after the value is set runs too.
+    auto ready = make_ready_future<int>(pool, 7);
+    REQUIRE(ready.is_ready());
+    REQUIRE(ready.then([](int x) { return x * 6; }).get() == 42);
+
+    // Continuations queued by a worker completing a promise run on that worker's queue.
+    Promise<int> promise(pool);
+    auto chained = promise.get_future().then([&pool](int x) {
+        REQUIRE(pool.worker_index().has_value());
+        return x;
+    });
+    std::atomic<bool> set{false};
+    pool.submit([&] {
+        promise.set_value(5);
+        set.store(true);
+    });
+    // Wait without helping, so only the workers can run the continuation.
+    while (!set.load() || !chained.is_ready())
+        std::this_thread::yield();
+    REQUIRE(chained.get() == 5);
+
+    std::atomic<int> ran{0};
+    auto v = async(pool, [&] { ran.fetch_add(1); }).then([&] { ran.fetch_add(1); });
+    v.get();
+    REQUIRE(ran.load() == 2);
+
+    // Move-only values pass through.
+    auto owned = async(pool, [] { return std::make_unique<int>(3); })
+            .then([](std::unique_ptr<int> p) { return *p; });
+    REQUIRE(owned.get() == 3);
+}
+
+TEST_CASE("future combinators, [future]") {
+    WorkStealingPool pool(3);
+
+    std::vector<Future<size_t>> parts;
+    for (size_t i = 0; i < 16; ++i)
+        parts.push_back(async(pool, [i] { burn(1000); return i * i; }));
+    const auto squares = when_all(std::move(parts)).get();
+    REQUIRE(squares.size() == 16);
+    for (size_t i = 0; i < squares.size(); ++i)
+        REQUIRE(squares[i] == i * i);
+
+    std::atomic<int> count{0};
+    std::vector<Future<void>> voids;
+    for (int i = 0; i < 8; ++i)
+        voids.push_back(async(pool, [&] { count.fetch_add(1); }));
+    when_all(std::move(voids)).get();
+    REQUIRE(count.load() == 8);
+
+    // The first promise set wins; later ones are dropped.
+    std::vector<Promise<int>> promises;
+    std::vector<Future<int>> racers;
+    for (int i = 0; i < 3; ++i) {
+        promises.emplace_back(pool);
+        racers.push_back(promises.back().get_future());
+    }
+    auto first = when_any(std::move(racers));
+    promises[2].set_value(30);
+    const auto [index, value] = first.get();
+    REQUIRE(index == 2);
+    REQUIRE(value == 30);
+    promises[0].set_value(10);
+    promises[1].set_value(20);
+
+    std::vector<Future<void>> void_racers;
+    void_racers.push_back(make_ready_future<void>(pool));
+    REQUIRE(when_any(std::move(void_racers)).get() == 0);
+}
+
+TEST_CASE("parallel reduce, [pool]") {
+    // Values spanning many magnitudes, so floating-point sums depend on the order of additions.
+    std::vector<double> values(1 << 16);
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> mantissa(1.0, 2.0);
+    for (auto &v: values)
+        v = std::ldexp(mantissa(rng), static_cast<int>(rng() % 60) - 30);
+
+    const auto sum = [&](const BlockedRange &r, double acc) {
+        for (auto i = r.begin(); i != r.end(); ++i)
+            acc += values[i];
+        return acc;
+    };
+    const auto plus = [](double a, double b) { return a + b; };
+    const BlockedRange range(0, values.size(), 256);
+
+    WorkStealingPool one(1), four(4);
+    const auto reference = one.parallel_deterministic_reduce(range, 0.0, sum, plus);
+    for (int run = 0; run < 5; ++run) {
+        // Bitwise identical, whatever the number of workers or steal timing.
+        REQUIRE(four.parallel_deterministic_reduce(range, 0.0, sum, plus) == reference);
+        REQUIRE(std::abs(four.parallel_reduce(range, 0.0, sum, plus) - reference) <= 1e-9 * std::abs(reference));
+    }
+
+    // Integer reductions agree exactly.
+    const auto count = [](const BlockedRange &r, size_t acc) { return acc + r.size(); };
+    const auto add = [](size_t a, size_t b) { return a + b; };
+    REQUIRE(four.parallel_reduce(BlockedRange(0, 100000, 7), size_t{0}, count, add) == 100000);
+    REQUIRE(four.parallel_deterministic_reduce(BlockedRange(0, 100000, 7), size_t{0}, count, add) == 100000);
+    REQUIRE(four.parallel_deterministic_reduce(BlockedRange(5, 5, 7), size_t{3}, count, add) == 3);
+
+    // Concatenation is associative but not commutative: only the deterministic reduce keeps the
+    // leaves in range order; parallel_reduce keeps every element but may reorder them.
+    const auto collect = [](const BlockedRange &r, std::vector<size_t> acc) {
+        for (auto i = r.begin(); i != r.end(); ++i)
+            acc.push_back(i);
+        return acc;
+    };
+    const auto concat = [](std::vector<size_t> a, std::vector<size_t> b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    };
+    std::vector<size_t> in_order(10000);
+    std::iota(in_order.begin(), in_order.end(), size_t{0});
+    const BlockedRange indices(0, in_order.size(), 16);
+    REQUIRE(four.parallel_deterministic_reduce(indices, std::vector<size_t>{}, collect, concat) == in_order);
+    auto shuffled = four.parallel_reduce(indices, std::vector<size_t>{}, collect, concat);
+    std::sort(shuffled.begin(), shuffled.end());
+    REQUIRE(shuffled == in_order);
+}
+
+TEST_CASE("deadline lane, [pool]") {
+    WorkStealingPool pool(1);
+    const auto before = pool.stats();
+    std::mutex mutex;
+    std::vector<int> order;
+    std::atomic<size_t> pending{15};
+    const auto record = [&](int tag) {
+        return [&, tag] {
+            {
+                std::lock_guard lock(mutex);
+                order.push_back(tag);
+            }
+            pending.fetch_sub(1);
+        };
+    };
+
+    // Queue plain tasks, then deadline tasks out of deadline order, all from the only worker.
+    const auto now = std::chrono::steady_clock::now();
+    pool.submit([&] {
+        for (int i = 0; i < 10; ++i)
+            pool.submit(record(100 + i));
+        for (const int ms: {30, 10, 50, -20, 40})
+            pool.submit(record(ms), now + std::chrono::milliseconds(ms));
+    });
+    while (pending.load() != 0)
+        std::this_thread::yield();
+
+    // Earliest deadline first, ahead of the plain LIFO work.
+    REQUIRE(order.size() == 15);
+    REQUIRE(std::vector<int>(order.begin(), order.begin() + 5) == std::vector<int>{-20, 10, 30, 40, 50});
+    REQUIRE(order[5] == 109);
+    const auto delta = pool.stats() - before;
+    REQUIRE(delta.deadline_tasks == 5);
+    REQUIRE(delta.deadline_misses >= 1);
+
+    // Deadline tasks submitted from outside the pool are picked up as well.
+    WorkStealingPool many(3);
+    std::atomic<size_t> left{32};
+    for (int i = 0; i < 32; ++i)
+        many.submit([&] { left.fetch_sub(1); }, std::chrono::steady_clock::now() + std::chrono::milliseconds(i));
+    while (left.load() != 0)
+        std::this_thread::yield();
+}
+
+TEST_CASE("pool aging, [pool]") {
+    // Position at which the oldest of 64 tasks queued on the only worker runs.
+    const auto oldest_position = [](size_t aging_interval) {
+        WorkStealingPool pool(1);
+        pool.set_aging_interval(aging_interval);
+        REQUIRE(pool.aging_interval() == aging_interval);
+        std::atomic<size_t> ran{0}, position{0};
+        pool.submit([&] {
+            pool.submit([&] { position.store(ran.fetch_add(1)); });
+            for (int i = 0; i < 63; ++i)
+                pool.submit([&] { ran.fetch_add(1); });
+        });
+        while (ran.load() != 64)
+            std::this_thread::yield();
+        const auto aged = pool.stats().aged;
+        REQUIRE((aging_interval == 0) == (aged == 0));
+        return position.load();
+    };
+    REQUIRE(oldest_position(0) == 63);
+    REQUIRE(oldest_position(4) <= 4);
+}
+
+TEST_CASE("shared runtime, [runtime]") {
+    REQUIRE(!Runtime::started());
+    REQUIRE(Runtime::configure(2));
+    auto &pool = Runtime::pool();
+    REQUIRE(Runtime::started());
+    REQUIRE(&Runtime::pool() == &pool);
+    REQUIRE(pool.num_workers() == 2);
+    REQUIRE(!Runtime::configure(4));
+
+    // Views share the workers but keep their own queues and limits.
+    auto a = Runtime::view(1);
+    auto b = Runtime::view();
+    REQUIRE(a->max_concurrency() == 1);
+    REQUIRE(b->max_concurrency() == 2);
+    std::atomic<size_t> sum_a{0}, sum_b{0};
+    std::thread other([&] {
+        b->parallel_for(0, 1000, 10, [&](size_t i) { sum_b.fetch_add(i); });
+    });
+    a->parallel_for(0, 1000, 10, [&](size_t i) { sum_a.fetch_add(i); });
+    other.join();
+    REQUIRE(sum_a.load() == 1000 * 999 / 2);
+    REQUIRE(sum_b.load() == 1000 * 999 / 2);
+}
+
+TEST_CASE("schedule record and replay, [schedule_replay]") {
+    WorkStealingPool pool(3);
+    // Binary spawn tree; every task reports the worker it ran on under its spawn-tree path.
+    std::mutex mutex;
+    std::map<std::string, int> ran_on;
+    std::atomic<size_t> pending{0};
+    const auto run_tree = [&](auto &spawner) {
+        std::function<void(std::string, int)> node = [&](std::string path, int depth) {
+            burn(20000);
+            {
+                std::lock_guard lock(mutex);
+                ran_on[path] = static_cast<int>(pool.worker_index().value_or(99));
+            }
+            for (int k = 0; k < 2 && depth > 0; ++k) {
+                pending.fetch_add(1);
+                spawner.spawn([&node, path, depth, k] { node(path + char('0' + k), depth - 1); });
+            }
+            pending.fetch_sub(1);
+        };
+        pending.store(1);
+        spawner.spawn([&node] { node("r", 6); });
+        while (pending.load() != 0)
+            std::this_thread::yield();
+    };
+
+    ScheduleRecorder recorder(pool);
+    run_tree(recorder);
+    const auto recorded_on = std::exchange(ran_on, {});
+    const auto log = recorder.take();
+    REQUIRE(recorded_on.size() == 127);
+    REQUIRE(std::ranges::count(log.events, ScheduleEventKind::Spawn, &ScheduleEvent::kind) == 127);
+    REQUIRE(log.assignment().size() == 127);
+    REQUIRE(std::ranges::is_sorted(log.events, {}, &ScheduleEvent::time_ns));
+
+    std::stringstream text;
+    log.save(text);
+    const auto loaded = ScheduleLog::load(text);
+    REQUIRE(loaded.events.size() == log.events.size());
+    REQUIRE(loaded.assignment() == log.assignment());
+
+    // Replaying forces every task onto the worker it ran on when recorded.
+    {
+        ScheduleReplayer replayer(pool, loaded);
+        run_tree(replayer);
+        REQUIRE(replayer.unmatched() == 0);
+    }
+    REQUIRE(ran_on == recorded_on);
+}
+
 // Procedure: wsq_test_owner
 void wsq_test_owner() {
     constexpr int64_t cap = 1 << 16;